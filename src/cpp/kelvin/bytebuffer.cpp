@@ -9,6 +9,11 @@
 
 // std includes
 #include <cstring>
+#include <algorithm>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -25,12 +30,19 @@ BufferUnderflow::~BufferUnderflow() {
 }
 
 BufferOverflow::BufferOverflow(ByteBuffer* buf) :
-    Exception(K273::fmtString("BufferOverflow : %s @ %s", buf->repr().c_str())) {
+    Exception(K273::fmtString("BufferOverflow : %s", buf->repr().c_str())) {
 }
 
 BufferOverflow::~BufferOverflow() {
 }
 
+MalformedVarint::MalformedVarint(ByteBuffer* buf) :
+    Exception(K273::fmtString("MalformedVarint : %s", buf->repr().c_str())) {
+}
+
+MalformedVarint::~MalformedVarint() {
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 ByteBuffer::ByteBuffer(int capacity, char* buffer) :
@@ -53,6 +65,18 @@ ByteBuffer::~ByteBuffer() {
     }
 }
 
+void ByteBuffer::setBuffer(char* buffer, int capacity) {
+    if (this->own_memory) {
+        free(this->buf);
+        this->own_memory = false;
+    }
+
+    this->buf = buffer;
+    this->capacity = capacity;
+    this->markpos = -1;
+    this->clear();
+}
+
 void ByteBuffer::compact() {
     // compact the pos to zero, and moves any memory around
 
@@ -79,6 +103,75 @@ void ByteBuffer::compact() {
     this->limit = this->capacity;
 }
 
+VarintStatus ByteBuffer::tryGetVarint(uint64_t& value) {
+    const uint8_t* ptr = reinterpret_cast <const uint8_t*> (this->buf + this->pos);
+    const int available = std::min(this->remaining(), MAX_VARINT_SIZE);
+
+    uint64_t result = 0;
+    for (int ii=0; ii<available; ii++) {
+        // the 10th byte holds only bit 63, and must be the last
+        if (unlikely(ii == MAX_VARINT_SIZE - 1 && ptr[ii] > 1)) {
+            return VarintStatus::MALFORMED;
+        }
+
+        result |= static_cast <uint64_t> (ptr[ii] & 0x7f) << (7 * ii);
+        if ((ptr[ii] & 0x80) == 0) {
+            value = result;
+            this->pos += ii + 1;
+            return VarintStatus::OK;
+        }
+    }
+
+    return VarintStatus::INCOMPLETE;
+}
+
+int ByteBuffer::getVarints(uint64_t* values, int count) {
+    /* While there are at least 8 bytes remaining, varints of up to 8 bytes (56 bits) are
+       decoded from one 8 byte load: the lowest clear top bit gives the length, without a branch
+       per byte.  With BMI2 the 7 bit groups are gathered with one pext. */
+
+    int decoded = 0;
+    while (decoded < count) {
+        if (this->remaining() >= 8) {
+            uint64_t word;
+            std::memcpy(&word, this->buf + this->pos, sizeof(word));
+
+            const uint64_t stops = ~word & 0x8080808080808080ULL;
+            if (likely(stops != 0)) {
+                const int bits = __builtin_ctzll(stops) + 1;
+                const uint64_t bytes = bits == 64 ? word : word & ((1ULL << bits) - 1);
+
+#ifdef __BMI2__
+                values[decoded++] = _pext_u64(bytes, 0x7f7f7f7f7f7f7f7fULL);
+#else
+                uint64_t result = 0;
+                for (int ii=0; ii<bits / 8; ii++) {
+                    result |= ((bytes >> (8 * ii)) & 0x7f) << (7 * ii);
+                }
+
+                values[decoded++] = result;
+#endif
+                this->pos += bits / 8;
+                continue;
+            }
+        }
+
+        // long varint, or near the end
+        const VarintStatus status = this->tryGetVarint(values[decoded]);
+        if (status != VarintStatus::OK) {
+            if (status == VarintStatus::MALFORMED) {
+                throw MalformedVarint(this);
+            }
+
+            break;
+        }
+
+        decoded++;
+    }
+
+    return decoded;
+}
+
 string ByteBuffer::repr() const {
     return K273::fmtString("String %xd: remaining: %d, pos: %d, limit: %d",
                            this,
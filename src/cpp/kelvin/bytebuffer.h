@@ -5,7 +5,9 @@
 
 // std includes
 #include <string>
+#include <cstdint>
 #include <cstring>
+#include <type_traits>
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -25,12 +27,30 @@ namespace Kelvin {
         virtual ~BufferOverflow();
     };
 
+    class MalformedVarint: public K273::Exception {
+    public:
+        MalformedVarint(ByteBuffer* buf);
+        virtual ~MalformedVarint();
+    };
+
+    /// result of ByteBuffer::tryGetVarint().  MALFORMED (more than 64 bits) will never
+    /// complete, unlike INCOMPLETE which needs more data.
+    enum class VarintStatus {
+        OK,
+        INCOMPLETE,
+        MALFORMED
+    };
+
     ///////////////////////////////////////////////////////////////////////////
 
     class ByteBuffer {
     private:
         static constexpr int BLOCKSIZE = 1024;
 
+    public:
+        // LEB128 of a uint64_t is at most 10 bytes
+        static constexpr int MAX_VARINT_SIZE = 10;
+
     public:
         ByteBuffer(int capacity=BLOCKSIZE, char* buffer=nullptr);
         ~ByteBuffer();
@@ -48,6 +68,13 @@ namespace Kelvin {
             return this->limit - this->pos;
         }
 
+        int getCapacity() const {
+            return this->capacity;
+        }
+
+        // switch to buffer (not owned, ie a pooled slab) and clear.  Frees any memory owned.
+        void setBuffer(char* buffer, int capacity);
+
         // call flip to start reading back what was written
         void flip() {
             this->limit = this->pos;
@@ -107,6 +134,185 @@ namespace Kelvin {
             return data;
         }
 
+        // non throwing gets, for parsing partial input (exceptions capture a stack trace, so
+        // are far too slow to probe with).  Return false, and consume nothing, if there isn't
+        // enough remaining.
+
+        template <typename T>
+        bool tryGet(T& data) {
+            if (unlikely((int) sizeof(T) > this->remaining())) {
+                return false;
+            }
+
+            std::memcpy(&data, this->buf + this->pos, sizeof(T));
+            this->pos += sizeof(T);
+            return true;
+        }
+
+        // as tryGet(), at offset from pos, without consuming
+        template <typename T>
+        bool peek(T& data, int offset=0) const {
+            if (unlikely(offset < 0 || offset + (int) sizeof(T) > this->remaining())) {
+                return false;
+            }
+
+            std::memcpy(&data, this->buf + this->pos + offset, sizeof(T));
+            return true;
+        }
+
+        bool trySkip(int size) {
+            if (unlikely(size < 0 || size > this->remaining())) {
+                return false;
+            }
+
+            this->pos += size;
+            return true;
+        }
+
+        bool tryRead(char* data, int size) {
+            if (unlikely(size < 0 || size > this->remaining())) {
+                return false;
+            }
+
+            std::memcpy(data, this->buf + this->pos, size);
+            this->pos += size;
+            return true;
+        }
+
+        // checked spans, for bulk reads in place.  Pointer to the next size bytes (which
+        // are consumed), or nullptr if there isn't enough remaining.
+        const char* trySpan(int size) {
+            if (unlikely(size < 0 || size > this->remaining())) {
+                return nullptr;
+            }
+
+            const char* span = this->buf + this->pos;
+            this->pos += size;
+            return span;
+        }
+
+        // as trySpan(), at offset from pos, without consuming
+        const char* peekSpan(int size, int offset=0) const {
+            if (unlikely(offset < 0 || size < 0 || offset + size > this->remaining())) {
+                return nullptr;
+            }
+
+            return this->buf + this->pos + offset;
+        }
+
+        // varints (LEB128, 7 bits per byte, low bits first).  Signed values are zigzag
+        // encoded first, so small negatives stay small.
+
+        static uint64_t zigzagEncode(int64_t value) {
+            return (static_cast <uint64_t> (value) << 1) ^ static_cast <uint64_t> (value >> 63);
+        }
+
+        static int64_t zigzagDecode(uint64_t value) {
+            return static_cast <int64_t> (value >> 1) ^ -static_cast <int64_t> (value & 1);
+        }
+
+        static int varintSize(uint64_t value) {
+            int size = 1;
+            while (value >= 0x80) {
+                value >>= 7;
+                size++;
+            }
+
+            return size;
+        }
+
+        /// nothing is consumed unless OK
+        VarintStatus tryGetVarint(uint64_t& value);
+
+        VarintStatus tryGetSignedVarint(int64_t& value) {
+            uint64_t encoded;
+            const VarintStatus status = this->tryGetVarint(encoded);
+            if (status == VarintStatus::OK) {
+                value = ByteBuffer::zigzagDecode(encoded);
+            }
+
+            return status;
+        }
+
+        uint64_t getVarint() {
+            uint64_t value;
+            const VarintStatus status = this->tryGetVarint(value);
+            if (unlikely(status != VarintStatus::OK)) {
+                if (status == VarintStatus::MALFORMED) {
+                    throw MalformedVarint(this);
+                }
+
+                throw BufferUnderflow(this);
+            }
+
+            return value;
+        }
+
+        int64_t getSignedVarint() {
+            return ByteBuffer::zigzagDecode(this->getVarint());
+        }
+
+        /// decodes up to count varints, returns the number decoded (stops at an incomplete one).
+        /// Throws MalformedVarint.
+        int getVarints(uint64_t* values, int count);
+
+        void putVarint(uint64_t value) {
+            if (unlikely(this->remaining() < MAX_VARINT_SIZE &&
+                         ByteBuffer::varintSize(value) > this->remaining())) {
+                throw BufferOverflow(this);
+            }
+
+            char* ptr = this->buf + this->pos;
+            while (value >= 0x80) {
+                *ptr++ = static_cast <char> (value | 0x80);
+                value >>= 7;
+            }
+
+            *ptr++ = static_cast <char> (value);
+            this->pos = ptr - this->buf;
+        }
+
+        void putSignedVarint(int64_t value) {
+            this->putVarint(ByteBuffer::zigzagEncode(value));
+        }
+
+        // bulk arrays of integral/floating types with explicit byte order (memcpy on a
+        // matching host, so also alignment safe)
+
+        template <typename T>
+        void putArrayLE(const T* data, int count) {
+            this->putArray(data, count, __ORDER_LITTLE_ENDIAN__);
+        }
+
+        template <typename T>
+        void putArrayBE(const T* data, int count) {
+            this->putArray(data, count, __ORDER_BIG_ENDIAN__);
+        }
+
+        template <typename T>
+        bool tryGetArrayLE(T* data, int count) {
+            return this->tryGetArray(data, count, __ORDER_LITTLE_ENDIAN__);
+        }
+
+        template <typename T>
+        bool tryGetArrayBE(T* data, int count) {
+            return this->tryGetArray(data, count, __ORDER_BIG_ENDIAN__);
+        }
+
+        template <typename T>
+        void getArrayLE(T* data, int count) {
+            if (unlikely(!this->tryGetArrayLE(data, count))) {
+                throw BufferUnderflow(this);
+            }
+        }
+
+        template <typename T>
+        void getArrayBE(T* data, int count) {
+            if (unlikely(!this->tryGetArrayBE(data, count))) {
+                throw BufferUnderflow(this);
+            }
+        }
+
         // puts
         template <typename T>
         void putDatatype(T data) {
@@ -161,6 +367,65 @@ namespace Kelvin {
 
         std::string repr() const;
 
+    private:
+        template <typename T>
+        static T swapBytes(T value) {
+            char bytes[sizeof(T)];
+            std::memcpy(bytes, &value, sizeof(T));
+            for (size_t ii=0; ii<sizeof(T) / 2; ii++) {
+                std::swap(bytes[ii], bytes[sizeof(T) - 1 - ii]);
+            }
+
+            std::memcpy(&value, bytes, sizeof(T));
+            return value;
+        }
+
+        template <typename T>
+        void putArray(const T* data, int count, int byte_order) {
+            static_assert(std::is_arithmetic <T>::value, "putArray() of integral/floating types");
+
+            // also catches count * sizeof(T) overflowing an int
+            if (unlikely(count < 0 || count > this->remaining() / (int) sizeof(T))) {
+                throw BufferOverflow(this);
+            }
+
+            const int size = count * sizeof(T);
+
+            if (byte_order == __BYTE_ORDER__ || sizeof(T) == 1) {
+                std::memcpy(this->buf + this->pos, data, size);
+
+            } else {
+                for (int ii=0; ii<count; ii++) {
+                    T swapped = ByteBuffer::swapBytes(data[ii]);
+                    std::memcpy(this->buf + this->pos + ii * sizeof(T), &swapped, sizeof(T));
+                }
+            }
+
+            this->pos += size;
+        }
+
+        template <typename T>
+        bool tryGetArray(T* data, int count, int byte_order) {
+            static_assert(std::is_arithmetic <T>::value, "getArray() of integral/floating types");
+
+            // also catches count * sizeof(T) overflowing an int
+            if (unlikely(count < 0 || count > this->remaining() / (int) sizeof(T))) {
+                return false;
+            }
+
+            const int size = count * sizeof(T);
+
+            std::memcpy(data, this->buf + this->pos, size);
+            if (byte_order != __BYTE_ORDER__ && sizeof(T) > 1) {
+                for (int ii=0; ii<count; ii++) {
+                    data[ii] = ByteBuffer::swapBytes(data[ii]);
+                }
+            }
+
+            this->pos += size;
+            return true;
+        }
+
     private:
         int pos;
         int markpos;
@@ -169,6 +434,6 @@ namespace Kelvin {
         int capacity;
 
         char* buf;
-        const bool own_memory;
+        bool own_memory;
     };
 }
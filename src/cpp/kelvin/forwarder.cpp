@@ -0,0 +1,216 @@
+// local includes
+#include "kelvin/forwarder.h"
+#include "kelvin/selector.h"
+
+// k273 includes
+#include <k273/logging.h>
+#include <k273/strutils.h>
+#include <k273/exception.h>
+
+// std includes
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+///////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const bool _debug_log = false;
+#define TRACE(fmt, args...) if (_debug_log) { K273::l_debug(fmt, ## args); }
+
+///////////////////////////////////////////////////////////////////////////////
+
+void Forwarder::Side::doRead(SelectionKey* key) {
+    this->forwarder->pump(this->index);
+    this->forwarder->updateInterests();
+}
+
+void Forwarder::Side::doWrite(SelectionKey* key) {
+    this->forwarder->pump(1 - this->index);
+    this->forwarder->updateInterests();
+}
+
+string Forwarder::Side::repr() const {
+    return K273::fmtString("Forwarder::Side(%d) of %s", this->index,
+                           this->forwarder->repr().c_str());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+Forwarder::Forwarder(Scheduler* scheduler, ConnectedSocket* a, ConnectedSocket* b,
+                     int pipe_size) :
+    scheduler(scheduler),
+    sockets{a, b},
+    sides{{this, 0}, {this, 1}},
+    directions(),
+    pipe_size(pipe_size),
+    interests{0, 0},
+    forwarding(false),
+    finish_cb(scheduler, this) {
+
+    for (int ii=0; ii<2; ii++) {
+        int fds[2];
+        if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+            throw K273::SysException("Forwarder pipe2()", errno);
+        }
+
+        Direction& direction = this->directions[ii];
+        direction.pipe_read = fds[0];
+        direction.pipe_write = fds[1];
+
+        // a larger pipe means fewer splices per byte, failure just keeps the default size
+        if (fcntl(direction.pipe_write, F_SETPIPE_SZ, pipe_size) == -1) {
+            K273::l_warning("Forwarder F_SETPIPE_SZ(%d): %s", pipe_size, strerror(errno));
+        }
+    }
+
+    this->pipe_size = fcntl(this->directions[0].pipe_write, F_GETPIPE_SZ);
+}
+
+Forwarder::~Forwarder() {
+    this->finish_cb.cancel();
+    this->stop();
+
+    for (int ii=0; ii<2; ii++) {
+        ::close(this->directions[ii].pipe_read);
+        ::close(this->directions[ii].pipe_write);
+    }
+}
+
+void Forwarder::start() {
+    ASSERT (!this->forwarding);
+    this->forwarding = true;
+
+    // sockets may already have data waiting
+    this->pump(0);
+    this->pump(1);
+    this->updateInterests();
+}
+
+void Forwarder::stop() {
+    for (int ii=0; ii<2; ii++) {
+        if (this->interests[ii] != 0) {
+            this->scheduler->registerHandler(&this->sides[ii], this->sockets[ii]->fileno(), 0);
+            this->interests[ii] = 0;
+        }
+    }
+
+    this->forwarding = false;
+}
+
+void Forwarder::finished() {
+}
+
+string Forwarder::repr() const {
+    return K273::fmtString("Forwarder(%d <-> %d)", this->sockets[0]->fileno(),
+                           this->sockets[1]->fileno());
+}
+
+void Forwarder::pump(int index) {
+    /* Moves data socket -> pipe -> socket until neither splice makes progress.  So once this
+       returns, anything left in the pipe means the destination is full. */
+
+    Direction& direction = this->directions[index];
+    const int src = this->sockets[index]->fileno();
+    const int dst = this->sockets[1 - index]->fileno();
+
+    const unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+    while (this->forwarding) {
+        bool progress = false;
+
+        if (!direction.src_eof && direction.in_pipe < this->pipe_size) {
+            ssize_t count = ::splice(src, nullptr, direction.pipe_write, nullptr,
+                                     this->pipe_size - direction.in_pipe, flags);
+            if (count > 0) {
+                direction.in_pipe += count;
+                progress = true;
+
+            } else if (count == 0) {
+                TRACE("Forwarder::pump() EOF on %d", src);
+                direction.src_eof = true;
+
+            } else if (errno != EAGAIN && errno != EINTR) {
+                this->error("splice() from socket");
+                return;
+            }
+        }
+
+        if (direction.in_pipe > 0) {
+            ssize_t count = ::splice(direction.pipe_read, nullptr, dst, nullptr,
+                                     direction.in_pipe, flags);
+            if (count > 0) {
+                direction.in_pipe -= count;
+                direction.forwarded += count;
+                progress = true;
+
+            } else if (count < 0 && errno != EAGAIN && errno != EINTR) {
+                this->error("splice() to socket");
+                return;
+            }
+        }
+
+        if (!progress) {
+            break;
+        }
+    }
+
+    // pass on the EOF once everything before it has gone
+    if (direction.src_eof && direction.in_pipe == 0 && !direction.dst_shutdown) {
+        ::shutdown(dst, SHUT_WR);
+        direction.dst_shutdown = true;
+    }
+}
+
+void Forwarder::updateInterests() {
+    if (!this->forwarding) {
+        return;
+    }
+
+    if (this->directions[0].dst_shutdown && this->directions[1].dst_shutdown) {
+        TRACE("Forwarder::updateInterests() both directions done %s", this->repr().c_str());
+        this->finish();
+        return;
+    }
+
+    for (int ii=0; ii<2; ii++) {
+        const Direction& outgoing = this->directions[ii];
+        const Direction& incoming = this->directions[1 - ii];
+
+        int ops = 0;
+        if (!outgoing.src_eof && outgoing.in_pipe == 0) {
+            ops |= OP_READ;
+        }
+
+        if (incoming.in_pipe > 0) {
+            ops |= OP_WRITE;
+        }
+
+        if (ops != this->interests[ii]) {
+            this->scheduler->registerHandler(&this->sides[ii], this->sockets[ii]->fileno(), ops);
+            this->interests[ii] = ops;
+        }
+    }
+}
+
+void Forwarder::error(const char* what) {
+    K273::l_warning("%s: %s failed: %s", this->repr().c_str(), what, strerror(errno));
+    this->finish();
+}
+
+void Forwarder::finish() {
+    // callers (pump(), Side::doRead() etc) still use this after we return, so finished() -
+    // which may well delete us - has to wait
+    this->stop();
+    this->finish_cb.callLater(0);
+}
+
+void Forwarder::doFinished() {
+    this->finished();
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+// local includes
+#include "kelvin/socket.h"
+#include "kelvin/scheduler.h"
+
+// std includes
+#include <string>
+#include <cstdint>
+
+namespace Kelvin {
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Forwards bytes both ways between two connected sockets with splice() through a pipe per
+    /// direction, so the payload never enters user space.  While a pipe is full its source
+    /// isn't read (backpressure is left to tcp), and the destination is only waited on for
+    /// writing while its pipe has data.  EOF on one side is passed on as a shutdown(SHUT_WR).
+    ///
+    /// The sockets must be non blocking, and are not owned (nor closed).
+
+    class Forwarder {
+    public:
+        Forwarder(Scheduler* scheduler, ConnectedSocket* a, ConnectedSocket* b,
+                  int pipe_size=256 * 1024);
+        virtual ~Forwarder();
+
+    public:
+        void start();
+        void stop();
+
+        bool isForwarding() const {
+            return this->forwarding;
+        }
+
+        // bytes written to b / a
+        int64_t getForwardedBytes(int direction) const {
+            return this->directions[direction].forwarded;
+        }
+
+        /// both directions reached EOF and were drained, or either socket errored.  Called with
+        /// forwarding already stopped, from a callLater(0) - so it may delete this.
+        virtual void finished();
+
+        std::string repr() const;
+
+    private:
+        class Side : public EventHandler {
+        public:
+            Side(Forwarder* forwarder, int index) :
+                forwarder(forwarder),
+                index(index) {
+            }
+
+            virtual ~Side() {
+            }
+
+            virtual void doRead(SelectionKey* key);
+            virtual void doWrite(SelectionKey* key);
+            virtual std::string repr() const;
+
+            Forwarder* forwarder;
+            const int index;
+        };
+
+        struct Direction {
+            int pipe_read;
+            int pipe_write;
+
+            // bytes sitting in the pipe
+            int in_pipe;
+            bool src_eof;
+            bool dst_shutdown;
+            int64_t forwarded;
+        };
+
+        // direction ii goes from sockets[ii] to sockets[1 - ii]
+        void pump(int direction);
+        void updateInterests();
+        void error(const char* what);
+
+        // stops and calls finished() once we are off the stack
+        void finish();
+        void doFinished();
+
+    private:
+        Scheduler* scheduler;
+        ConnectedSocket* sockets[2];
+        Side sides[2];
+        Direction directions[2];
+
+        int pipe_size;
+        int interests[2];
+        bool forwarding;
+
+        DEFERRED(FinishLater, Forwarder, doFinished);
+        FinishLater finish_cb;
+    };
+
+}
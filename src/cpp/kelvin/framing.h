@@ -0,0 +1,159 @@
+#pragma once
+
+// local includes
+#include "kelvin/streamer.h"
+#include "kelvin/bytebuffer.h"
+
+// k273 includes
+#include <k273/logging.h>
+
+// std includes
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace Kelvin::Streamer {
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// A complete frame (header included), pointing straight into the input buffer.  Only
+    /// valid for the duration of the callback.
+    struct FrameView {
+        char* data;
+        int size;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Framing traits for a fixed size header struct with a length field, ie
+    /// LengthField <MessageHeader, &MessageHeader::message_length>.  inclusive if the length
+    /// counts the header itself, otherwise the frame is header + length.
+
+    template <typename Header_T, auto Field, bool inclusive=true>
+    struct LengthField {
+        static constexpr int HEADER_SIZE = sizeof(Header_T);
+
+        // header may be unaligned (and packed)
+        static uint64_t frameLength(const char* data) {
+            Header_T header;
+            std::memcpy(&header, data, sizeof(Header_T));
+
+            uint64_t length = header.*Field;
+            return inclusive ? length : length + HEADER_SIZE;
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Splits the input into frames, as described by Framing_T (see LengthField), and hands
+    /// each complete frame to onFrame() - or all the complete frames from one read to
+    /// onFrames() if batched.  A partial frame is left in the buffer until the rest arrives,
+    /// nothing is copied or thrown.  Base_T is ChildProtocol or ConnectingProtocol.
+    ///
+    /// A frame must also fit in the input (getMaxInput(), the slab size by default), so longer
+    /// ones are bad frames whatever max_frame_length is.  Use setRingInput() for large frames.
+
+    template <typename Framing_T, typename Base_T>
+    class FramingProtocol : public Base_T {
+    public:
+        template <typename... Args>
+        FramingProtocol(Args&&... args) :
+            Base_T(std::forward <Args> (args)...),
+            max_frame_length(16 * 1024 * 1024),
+            batched(false) {
+        }
+
+        virtual ~FramingProtocol() {
+        }
+
+    public:
+        virtual void onFrame(char* data, int size) {
+            K273::l_warning("stubbed - please implement: FramingProtocol::onFrame() %s",
+                            this->repr().c_str());
+        }
+
+        /// batched delivery, default is one onFrame() per frame
+        virtual void onFrames(const FrameView* frames, int count) {
+            for (int ii=0; ii<count && this->isConnected(); ii++) {
+                this->onFrame(frames[ii].data, frames[ii].size);
+            }
+        }
+
+        /// frame length is less than the header, or more than max_frame_length or the input can
+        /// hold.  Default disconnects - there is no way to resync.  Batched, the complete frames
+        /// before it are handed to onFrames() first.
+        virtual void onBadFrame(uint64_t length) {
+            K273::l_error("%s: bad frame length %lu, disconnecting", this->repr().c_str(),
+                          (unsigned long) length);
+            this->disconnect();
+        }
+
+        void setMaxFrameLength(int max_frame_length) {
+            this->max_frame_length = max_frame_length;
+        }
+
+        void setBatched(bool batched) {
+            this->batched = batched;
+        }
+
+        virtual void onBuffer(ByteBuffer& buf) {
+            this->batch.clear();
+
+            const uint64_t max_length = std::min(this->max_frame_length, this->getMaxInput());
+
+            while (buf.remaining() >= Framing_T::HEADER_SIZE) {
+                char* data = buf.getInternalBuf();
+
+                const uint64_t length = Framing_T::frameLength(data);
+                if (length < (uint64_t) Framing_T::HEADER_SIZE ||
+                    length > max_length) {
+                    // already skipped, so deliver them (an override may not disconnect)
+                    this->flushBatch();
+                    if (this->isConnected()) {
+                        this->onBadFrame(length);
+                    }
+
+                    return;
+                }
+
+                // partial frame
+                if (length > (uint64_t) buf.remaining()) {
+                    break;
+                }
+
+                buf.skip(length);
+
+                if (this->batched) {
+                    this->batch.push_back(FrameView{data, (int) length});
+
+                } else {
+                    this->onFrame(data, length);
+                    if (!this->isConnected()) {
+                        return;
+                    }
+                }
+            }
+
+            this->flushBatch();
+        }
+
+    private:
+        void flushBatch() {
+            // frames are still valid, only the consumed position has moved
+            if (!this->batch.empty()) {
+                this->onFrames(this->batch.data(), this->batch.size());
+                this->batch.clear();
+            }
+        }
+
+    private:
+        int max_frame_length;
+        bool batched;
+
+        // reused across reads
+        std::vector <FrameView> batch;
+    };
+
+}
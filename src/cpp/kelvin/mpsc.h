@@ -0,0 +1,90 @@
+#pragma once
+
+// std includes
+#include <atomic>
+#include <utility>
+
+namespace Kelvin {
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Unbounded lock-free multi producer, single consumer queue (Vyukov style).  push() is
+    /// wait free (a single exchange) and may be called from any thread.  pop()/empty() must
+    /// only be called from the consumer thread.
+    ///
+    /// Note a producer preempted between its exchange and linking its node makes the queue
+    /// look empty to pop() until it resumes, while empty() (which only looks at the head)
+    /// already reports non empty.  Which is what the consumer wants before going to sleep.
+
+    template <typename T> class MPSCQueue {
+    private:
+        struct Node {
+            Node() :
+                next(nullptr) {
+            }
+
+            explicit Node(T&& value) :
+                next(nullptr),
+                value(std::move(value)) {
+            }
+
+            std::atomic <Node*> next;
+            T value;
+        };
+
+    public:
+        MPSCQueue() :
+            head(new Node),
+            tail(head.load(std::memory_order_relaxed)) {
+        }
+
+        ~MPSCQueue() {
+            T value;
+            while (this->pop(value)) {
+            }
+
+            delete this->tail;
+        }
+
+        MPSCQueue(const MPSCQueue&) = delete;
+        MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    public:
+        // any thread
+        void push(T value) {
+            Node* node = new Node(std::move(value));
+
+            // seq_cst, so a following load by the producer is ordered after the push
+            Node* prev = this->head.exchange(node, std::memory_order_seq_cst);
+            prev->next.store(node, std::memory_order_release);
+        }
+
+        // consumer only
+        bool pop(T& value) {
+            Node* next = this->tail->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return false;
+            }
+
+            value = std::move(next->value);
+
+            // next becomes the stub
+            delete this->tail;
+            this->tail = next;
+            return true;
+        }
+
+        // consumer only
+        bool empty() const {
+            return this->head.load(std::memory_order_seq_cst) == this->tail;
+        }
+
+    private:
+        // producers side
+        alignas(64) std::atomic <Node*> head;
+
+        // consumer side
+        alignas(64) Node* tail;
+    };
+
+}
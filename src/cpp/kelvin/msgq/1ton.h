@@ -1,13 +1,18 @@
 #pragma once
 
+// local includes
+#include "kelvin/msgq/wakeup.h"
+
 // k273 includes
 #include <k273/util.h>
 #include <k273/logging.h>
 #include <k273/exception.h>
 
 // std includes
+#include <cerrno>
 #include <cstring>
 #include <atomic>
+#include <unistd.h>
 
 namespace Kelvin::MsgQ::OneToMany {
 
@@ -57,6 +62,9 @@ namespace Kelvin::MsgQ::OneToMany {
         std::atomic <size_t> consume_index;
         uint8_t pad__consume_index[CACHE_LINE_SIZE - sizeof(std::atomic <size_t>)];
 
+        // consumers about to block (see Consumer::armWakeup())
+        WakeupTable wakeup;
+
     private:
         CacheLine buf[0];
     };
@@ -86,7 +94,7 @@ namespace Kelvin::MsgQ::OneToMany {
             this->mem = reinterpret_cast <Memory*> (ptr);
 
             if (clear) {
-                std::memset(this->mem, 0, this->memory_size);
+                std::memset((void*) this->mem, 0, this->memory_size);
             }
 
             this->acquire_index = this->mem->write_index.load(std::memory_order_acquire);
@@ -160,8 +168,10 @@ namespace Kelvin::MsgQ::OneToMany {
 
         void publish() {
             ASSERT (this->reserved != nullptr);
-            this->mem->write_index.store(this->acquire_index, std::memory_order_release);
+            this->mem->write_index.store(this->acquire_index, std::memory_order_seq_cst);
             this->reserved = nullptr;
+
+            this->waker.wakeSleepers(&this->mem->wakeup);
         }
 
     private:
@@ -176,6 +186,9 @@ namespace Kelvin::MsgQ::OneToMany {
 
         // pointer to first reserved cached line
         const CacheLine* reserved;
+
+        // sends wakeups to blocked consumers
+        Waker waker;
     };
 
     ///////////////////////////////////////////////////////////////////////////////
@@ -195,7 +208,7 @@ namespace Kelvin::MsgQ::OneToMany {
             this->mem = reinterpret_cast <Memory*> (ptr);
 
             if (clear) {
-                std::memset(this->mem, 0, this->memory_size);
+                std::memset((void*) this->mem, 0, this->memory_size);
             }
 
             // will set up internal variable to read from the queue
@@ -247,6 +260,41 @@ namespace Kelvin::MsgQ::OneToMany {
             this->mem->consume_index.store(this->internal_consume_index, std::memory_order_release);
         }
 
+        bool available() const {
+            return this->mem->write_index.load(std::memory_order_seq_cst) != this->internal_consume_index;
+        }
+
+        /// Claims a wakeup slot in the queue (any process).  The consumer may then block
+        /// selecting on getWakeupFd() - producers wake it if it is armed.  Call after
+        /// setMemory(), and disableWakeup() before the memory goes.
+        void enableWakeup() {
+            this->waiter.attach(&this->mem->wakeup);
+        }
+
+        void disableWakeup() {
+            this->waiter.detach();
+        }
+
+        int getWakeupFd() const {
+            return this->waiter.getFd();
+        }
+
+        /// About to block.  Asks producers to wake us.  Returns false if there is something to
+        /// read already (ie don't block).
+        bool armWakeup() {
+            this->waiter.arm();
+            return !this->available();
+        }
+
+        void disarmWakeup() {
+            this->waiter.disarm();
+        }
+
+        /// the wakeup fd is readable
+        void drainWakeup() {
+            this->waiter.drain();
+        }
+
     private:
         // actual pointer to memory
         Memory* mem;
@@ -256,6 +304,8 @@ namespace Kelvin::MsgQ::OneToMany {
 
         // internal consume index (only used be reader)
         size_t internal_consume_index;
+
+        Waiter waiter;
     };
 
 }
@@ -1,12 +1,18 @@
 #pragma once
 
+// local includes
+#include "kelvin/msgq/wakeup.h"
+
 // k273 includes
 #include <k273/util.h>
 #include <k273/logging.h>
 #include <k273/exception.h>
 
 // std includes
+#include <atomic>
+#include <cerrno>
 #include <cstring>
+#include <unistd.h>
 
 namespace Kelvin::MsgQ::ManyToOne {
 
@@ -51,6 +57,9 @@ namespace Kelvin::MsgQ::ManyToOne {
         volatile size_t consume_index;
         uint8_t pad__consume_index[CACHE_LINE_SIZE - sizeof(std::atomic <size_t>)];
 
+        // consumers about to block (see Consumer::armWakeup())
+        WakeupTable wakeup;
+
         // modulo 2 calculations:
         // basically as long as QUEUE_SIZE is of power of 2, the following works
         // with unsigned arithmetic wrapping.
@@ -161,6 +170,9 @@ namespace Kelvin::MsgQ::ManyToOne {
             __sync_add_and_fetch(&this->reserved->data_count, this->reserve_count);
             this->reserve_count = 0;
             this->reserved = nullptr;
+
+            // __sync_add_and_fetch() above is a full barrier
+            this->waker.wakeSleepers(&this->mem->wakeup);
         }
 
     private:
@@ -175,6 +187,9 @@ namespace Kelvin::MsgQ::ManyToOne {
 
         // reserve count
         size_t reserve_count;
+
+        // sends wakeups to blocked consumers
+        Waker waker;
     };
 
     ///////////////////////////////////////////////////////////////////////////////
@@ -195,7 +210,7 @@ namespace Kelvin::MsgQ::ManyToOne {
             this->mem = reinterpret_cast <Memory*> (ptr);
 
             if (clear) {
-                std::memset(this->mem, 0, this->queue_size);
+                std::memset(this->mem, 0, this->memory_size);
             }
         }
 
@@ -272,6 +287,48 @@ namespace Kelvin::MsgQ::ManyToOne {
             this->reserved = nullptr;
         }
 
+        bool available() const {
+            // a reserved but not yet published line isn't available - its producer will see
+            // us sleeping when it publishes
+            size_t consume_index = this->mem->consume_index;
+            if (consume_index == this->mem->write_index) {
+                return false;
+            }
+
+            return this->mem->getCacheLine(consume_index % this->queue_size)->data_count != 0;
+        }
+
+        /// Claims a wakeup slot in the queue (any process).  The consumer may then block
+        /// selecting on getWakeupFd() - producers wake it if it is armed.  Call after
+        /// setMemory(), and disableWakeup() before the memory goes.
+        void enableWakeup() {
+            this->waiter.attach(&this->mem->wakeup);
+        }
+
+        void disableWakeup() {
+            this->waiter.detach();
+        }
+
+        int getWakeupFd() const {
+            return this->waiter.getFd();
+        }
+
+        /// About to block.  Asks producers to wake us.  Returns false if there is something to
+        /// read already (ie don't block).
+        bool armWakeup() {
+            this->waiter.arm();
+            return !this->available();
+        }
+
+        void disarmWakeup() {
+            this->waiter.disarm();
+        }
+
+        /// the wakeup fd is readable
+        void drainWakeup() {
+            this->waiter.drain();
+        }
+
     private:
         // actual pointer to memory
         Memory* mem;
@@ -281,6 +338,8 @@ namespace Kelvin::MsgQ::ManyToOne {
 
         // pointer to first reserved block
         CacheLine* reserved;
+
+        Waiter waiter;
     };
 
 }
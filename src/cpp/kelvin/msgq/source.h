@@ -0,0 +1,104 @@
+#pragma once
+
+// local includes
+#include "kelvin/scheduler.h"
+#include "kelvin/msgq/1ton.h"
+#include "kelvin/msgq/nto1.h"
+
+// std includes
+#include <string>
+#include <cstdint>
+
+namespace Kelvin::MsgQ {
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // the two consumers differ in how a message is consumed
+
+    inline const uint8_t* nextMessage(OneToMany::Consumer* consumer) {
+        return consumer->next(false);
+    }
+
+    inline void doneMessage(OneToMany::Consumer* consumer) {
+        consumer->consumeAll();
+    }
+
+    inline const uint8_t* nextMessage(ManyToOne::Consumer* consumer) {
+        return consumer->next();
+    }
+
+    inline void doneMessage(ManyToOne::Consumer* consumer) {
+        consumer->consume();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    /// Adapts a MsgQ consumer as a Scheduler PollSource.  Messages are handed to onMessage() on
+    /// the scheduler's thread, and released once it returns.  So the scheduler can block when
+    /// idle, the consumer's wakeup fd is registered with it (see Consumer::enableWakeup()) -
+    /// producers in any process wake it.
+    ///
+    /// usage:
+    ///    scheduler->addPollSource(source);
+
+    template <typename Consumer_T> class ConsumerSource : public PollSource, public EventHandler {
+    public:
+        ConsumerSource(Scheduler* scheduler, Consumer_T* consumer, int budget=64) :
+            scheduler(scheduler),
+            consumer(consumer),
+            budget(budget) {
+            this->consumer->enableWakeup();
+            this->scheduler->registerHandler(this, this->consumer->getWakeupFd(), OP_READ);
+        }
+
+        virtual ~ConsumerSource() {
+            this->scheduler->registerHandler(this, this->consumer->getWakeupFd(), 0);
+            this->consumer->disableWakeup();
+        }
+
+    public:
+        // interface
+        virtual void onMessage(const uint8_t* data) = 0;
+
+        virtual std::string repr() const {
+            return "ConsumerSource";
+        }
+
+    public:
+        virtual int pollSource() {
+            int count = 0;
+            while (count < this->budget) {
+                const uint8_t* data = nextMessage(this->consumer);
+                if (data == nullptr) {
+                    break;
+                }
+
+                this->onMessage(data);
+                doneMessage(this->consumer);
+                count++;
+            }
+
+            return count;
+        }
+
+        virtual bool armWakeup() {
+            return this->consumer->armWakeup();
+        }
+
+        virtual void disarmWakeup() {
+            this->consumer->disarmWakeup();
+        }
+
+        // woken, the messages are handled by pollSource()
+        virtual void doRead(SelectionKey* key) {
+            this->consumer->drainWakeup();
+        }
+
+    private:
+        Scheduler* scheduler;
+        Consumer_T* consumer;
+
+        // max messages per pass, so one busy queue can't starve everything else
+        const int budget;
+    };
+
+}
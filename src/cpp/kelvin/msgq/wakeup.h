@@ -0,0 +1,261 @@
+#pragma once
+
+// k273 includes
+#include <k273/util.h>
+#include <k273/logging.h>
+#include <k273/exception.h>
+
+// std includes
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+namespace Kelvin::MsgQ {
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // Waking blocked consumers.  Queues live in shared memory across processes, so an eventfd
+    // number means nothing to a producer in another process.  Instead each consumer that wants
+    // waking claims a slot in the queue's WakeupTable, naming a unix datagram socket (abstract,
+    // autobound) that its Scheduler selects on.  A producer sends a byte to every slot that is
+    // sleeping.  Plain words with __atomic builtins, as the table is memset with the queue.
+
+    constexpr int MAX_WAKEUP_SLOTS = 16;
+
+    struct WakeupSlot {
+        uint32_t in_use;
+        uint32_t sleeping;
+        int32_t pid;
+        uint32_t address_len;
+        char address[48];
+    };
+
+    static_assert(sizeof(WakeupSlot) == 64, "WakeupSlot not a cache line");
+
+    struct WakeupTable {
+        // number of slots sleeping, so producers only scan when someone is asleep
+        uint32_t sleepers;
+        uint8_t pad__sleepers[64 - sizeof(uint32_t)];
+
+        WakeupSlot slots[MAX_WAKEUP_SLOTS];
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // consumer side
+
+    class Waiter {
+    public:
+        Waiter() :
+            table(nullptr),
+            slot(nullptr),
+            fd(-1) {
+        }
+
+        ~Waiter() {
+            this->detach();
+        }
+
+        Waiter(const Waiter&) = delete;
+        Waiter& operator=(const Waiter&) = delete;
+
+    public:
+        void attach(WakeupTable* table) {
+            ASSERT (this->slot == nullptr);
+
+            this->fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (this->fd == -1) {
+                throw K273::SysException("MsgQ wakeup socket()", errno);
+            }
+
+            // binding just the family autobinds to a unique abstract address
+            struct sockaddr_un addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+
+            socklen_t addr_len = sizeof(sa_family_t);
+            if (::bind(this->fd, (struct sockaddr*) &addr, addr_len) != 0) {
+                int err = errno;
+                this->closeFd();
+                throw K273::SysException("MsgQ wakeup bind()", err);
+            }
+
+            addr_len = sizeof(addr);
+            ::getsockname(this->fd, (struct sockaddr*) &addr, &addr_len);
+            ASSERT (addr_len <= sizeof(this->slot->address));
+
+            for (int ii=0; ii<MAX_WAKEUP_SLOTS; ii++) {
+                WakeupSlot* slot = &table->slots[ii];
+                if (!Waiter::claim(table, slot)) {
+                    continue;
+                }
+
+                slot->sleeping = 0;
+                std::memcpy(slot->address, &addr, addr_len);
+                __atomic_store_n(&slot->address_len, addr_len, __ATOMIC_RELEASE);
+
+                this->table = table;
+                this->slot = slot;
+                return;
+            }
+
+            this->closeFd();
+            throw K273::Exception("MsgQ no free wakeup slots");
+        }
+
+        void detach() {
+            if (this->slot != nullptr) {
+                this->disarm();
+                __atomic_store_n(&this->slot->address_len, 0, __ATOMIC_RELAXED);
+                __atomic_store_n(&this->slot->pid, 0, __ATOMIC_RELAXED);
+                __atomic_store_n(&this->slot->in_use, 0, __ATOMIC_RELEASE);
+
+                this->table = nullptr;
+                this->slot = nullptr;
+            }
+
+            this->closeFd();
+        }
+
+        int getFd() const {
+            return this->fd;
+        }
+
+        /// ordered before the caller's check of the queue (and a producer's publish before its
+        /// check of sleepers), so either the consumer sees the message or the producer sees it
+        /// sleeping
+        void arm() {
+            if (this->slot != nullptr &&
+                __atomic_exchange_n(&this->slot->sleeping, 1, __ATOMIC_SEQ_CST) == 0) {
+                __atomic_add_fetch(&this->table->sleepers, 1, __ATOMIC_SEQ_CST);
+            }
+        }
+
+        void disarm() {
+            if (this->slot != nullptr) {
+                Waiter::clearSleeping(this->table, this->slot);
+            }
+        }
+
+        // read any wakeups sent
+        void drain() {
+            char buf[64];
+            while (::recv(this->fd, buf, sizeof(buf), 0) > 0) {
+            }
+        }
+
+        // whoever clears sleeping gives back its count
+        static bool clearSleeping(WakeupTable* table, WakeupSlot* slot) {
+            if (__atomic_exchange_n(&slot->sleeping, 0, __ATOMIC_SEQ_CST) != 0) {
+                __atomic_sub_fetch(&table->sleepers, 1, __ATOMIC_SEQ_CST);
+                return true;
+            }
+
+            return false;
+        }
+
+    private:
+        static bool claim(WakeupTable* table, WakeupSlot* slot) {
+            const int32_t pid = ::getpid();
+
+            uint32_t expected = 0;
+            if (__atomic_compare_exchange_n(&slot->in_use, &expected, 1, false,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                __atomic_store_n(&slot->pid, pid, __ATOMIC_SEQ_CST);
+                return true;
+            }
+
+            // reclaim the slot of a consumer process that died without detaching
+            int32_t owner = __atomic_load_n(&slot->pid, __ATOMIC_SEQ_CST);
+            if (owner > 0 && ::kill(owner, 0) == -1 && errno == ESRCH &&
+                __atomic_compare_exchange_n(&slot->pid, &owner, pid, false,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                K273::l_warning("MsgQ reclaiming wakeup slot of dead process %d", owner);
+                Waiter::clearSleeping(table, slot);
+                return true;
+            }
+
+            return false;
+        }
+
+        void closeFd() {
+            if (this->fd != -1) {
+                ::close(this->fd);
+                this->fd = -1;
+            }
+        }
+
+    private:
+        WakeupTable* table;
+        WakeupSlot* slot;
+        int fd;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // producer side
+
+    class Waker {
+    public:
+        Waker() :
+            fd(-1) {
+        }
+
+        ~Waker() {
+            if (this->fd != -1) {
+                ::close(this->fd);
+            }
+        }
+
+        Waker(const Waker&) = delete;
+        Waker& operator=(const Waker&) = delete;
+
+    public:
+        /// call after publishing (with a full barrier in between)
+        void wakeSleepers(WakeupTable* table) {
+            if (likely(__atomic_load_n(&table->sleepers, __ATOMIC_SEQ_CST) == 0)) {
+                return;
+            }
+
+            for (int ii=0; ii<MAX_WAKEUP_SLOTS; ii++) {
+                WakeupSlot* slot = &table->slots[ii];
+                if (__atomic_load_n(&slot->sleeping, __ATOMIC_RELAXED) != 0 &&
+                    Waiter::clearSleeping(table, slot)) {
+                    this->wake(slot);
+                }
+            }
+        }
+
+    private:
+        void wake(const WakeupSlot* slot) {
+            const socklen_t addr_len = __atomic_load_n(&slot->address_len, __ATOMIC_ACQUIRE);
+            if (addr_len == 0) {
+                return;
+            }
+
+            if (this->fd == -1) {
+                this->fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (this->fd == -1) {
+                    K273::l_error("MsgQ wakeup socket(): %s", strerror(errno));
+                    return;
+                }
+            }
+
+            struct sockaddr_un addr;
+            std::memcpy(&addr, slot->address, addr_len);
+
+            // EAGAIN - a wakeup is already queued, ECONNREFUSED - the consumer has gone
+            const char one = 1;
+            if (::sendto(this->fd, &one, sizeof(one), MSG_DONTWAIT,
+                         (struct sockaddr*) &addr, addr_len) < 0 &&
+                errno != EAGAIN && errno != ECONNREFUSED) {
+                K273::l_error("MsgQ failed to wakeup consumer: %s", strerror(errno));
+            }
+        }
+
+    private:
+        int fd;
+    };
+
+}
@@ -0,0 +1,144 @@
+// local includes
+#include "kelvin/outchain.h"
+
+// k273 includes
+#include <k273/logging.h>
+#include <k273/exception.h>
+
+// std includes
+#include <cstring>
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+SegmentPool::SegmentPool(int max_free) :
+    free_list(nullptr),
+    free_count(0),
+    max_free(max_free) {
+}
+
+SegmentPool::~SegmentPool() {
+    while (this->free_list != nullptr) {
+        Segment* segment = this->free_list;
+        this->free_list = segment->next;
+        delete segment;
+    }
+}
+
+Segment* SegmentPool::acquire() {
+    Segment* segment = this->free_list;
+    if (segment != nullptr) {
+        this->free_list = segment->next;
+        this->free_count--;
+
+    } else {
+        segment = new Segment;
+    }
+
+    segment->next = nullptr;
+    segment->start = segment->end = 0;
+    return segment;
+}
+
+void SegmentPool::release(Segment* segment) {
+    if (this->free_count >= this->max_free) {
+        delete segment;
+        return;
+    }
+
+    segment->next = this->free_list;
+    this->free_list = segment;
+    this->free_count++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+OutputChain::OutputChain(SegmentPool& pool) :
+    pool(pool),
+    head(nullptr),
+    tail(nullptr),
+    total(0) {
+}
+
+OutputChain::~OutputChain() {
+    this->clear();
+}
+
+void OutputChain::append(const char* data, int size) {
+    ASSERT (size >= 0);
+    this->total += size;
+
+    while (size > 0) {
+        if (this->tail == nullptr || this->tail->end == Segment::DATA_SIZE) {
+            Segment* segment = this->pool.acquire();
+            if (this->tail == nullptr) {
+                this->head = segment;
+            } else {
+                this->tail->next = segment;
+            }
+
+            this->tail = segment;
+        }
+
+        const int count = std::min(size, Segment::DATA_SIZE - this->tail->end);
+        std::memcpy(this->tail->data + this->tail->end, data, count);
+        this->tail->end += count;
+
+        data += count;
+        size -= count;
+    }
+}
+
+int OutputChain::gather(struct iovec* iov, int max_iov) const {
+    int count = 0;
+    for (Segment* segment = this->head; segment != nullptr && count < max_iov;
+         segment = segment->next) {
+
+        if (segment->end > segment->start) {
+            iov[count].iov_base = segment->data + segment->start;
+            iov[count].iov_len = segment->end - segment->start;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void OutputChain::consume(int count) {
+    ASSERT (count >= 0 && count <= this->total);
+    this->total -= count;
+
+    while (count > 0) {
+        Segment* segment = this->head;
+        const int available = segment->end - segment->start;
+
+        if (count < available) {
+            segment->start += count;
+            return;
+        }
+
+        count -= available;
+        this->head = segment->next;
+        this->pool.release(segment);
+    }
+
+    if (this->head == nullptr) {
+        this->tail = nullptr;
+    }
+}
+
+void OutputChain::clear() {
+    while (this->head != nullptr) {
+        Segment* segment = this->head;
+        this->head = segment->next;
+        this->pool.release(segment);
+    }
+
+    this->tail = nullptr;
+    this->total = 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+// std includes
+#include <cstdint>
+#include <sys/uio.h>
+
+namespace Kelvin {
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// fixed size block of pending output, linked into an OutputChain
+    struct Segment {
+        static constexpr int SIZE = 16 * 1024;
+        static constexpr int DATA_SIZE = SIZE - 16;
+
+        Segment* next;
+
+        // unsent data is [start, end)
+        int start;
+        int end;
+
+        char data[DATA_SIZE];
+    };
+
+    static_assert(sizeof(Segment) == Segment::SIZE, "Segment header not 16 bytes");
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Free list of segments.  Not thread safe - one per Scheduler (see
+    /// Scheduler::getOutputPool()).  Keeps at most max_free segments around, the rest go back
+    /// to the heap.
+
+    class SegmentPool {
+    public:
+        SegmentPool(int max_free=1024);
+        ~SegmentPool();
+
+    public:
+        Segment* acquire();
+        void release(Segment* segment);
+
+        int getFreeCount() const {
+            return this->free_count;
+        }
+
+    private:
+        Segment* free_list;
+        int free_count;
+        const int max_free;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Pending output as a chain of pooled segments.  Appending never moves data already in
+    /// the chain and has no limit, gather() hands the unsent data to writev()/sendmsg()
+    /// without compacting.
+
+    class OutputChain {
+    public:
+        OutputChain(SegmentPool& pool);
+        ~OutputChain();
+
+    public:
+        void append(const char* data, int size);
+
+        /// fills iov with up to max_iov entries of unsent data, returns the number filled
+        int gather(struct iovec* iov, int max_iov) const;
+
+        /// count bytes have been sent, releases segments fully sent
+        void consume(int count);
+
+        /// drops everything
+        void clear();
+
+        int64_t size() const {
+            return this->total;
+        }
+
+        bool empty() const {
+            return this->total == 0;
+        }
+
+    private:
+        SegmentPool& pool;
+
+        Segment* head;
+        Segment* tail;
+
+        int64_t total;
+    };
+
+}
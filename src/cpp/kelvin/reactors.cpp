@@ -0,0 +1,123 @@
+// local includes
+#include "kelvin/reactors.h"
+
+// k273 includes
+#include <k273/logging.h>
+#include <k273/exception.h>
+
+// std includes
+#include <thread>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const bool _debug_log = false;
+#define TRACE(fmt, args...) if (_debug_log) { K273::l_debug(fmt, ## args); }
+
+///////////////////////////////////////////////////////////////////////////////
+
+Reactors::Reactors(int count, const string& selector_name, bool interrupt_handler) :
+    first_cpu(-1) {
+
+    ASSERT (count > 0);
+
+    // Note the interrupt handler blocks the signals on this thread, which the reactor threads
+    // then inherit - so only reactor 0 sees them.
+    for (int ii=0; ii<count; ii++) {
+        this->selectors.emplace_back(Selector::create(selector_name));
+        this->schedulers.emplace_back(new Scheduler(this->selectors.back().get(),
+                                                    interrupt_handler && ii == 0));
+    }
+}
+
+Reactors::~Reactors() {
+    // schedulers before their selectors
+    this->schedulers.clear();
+    this->selectors.clear();
+}
+
+void Reactors::setAffinity(int first_cpu) {
+    this->first_cpu = first_cpu;
+}
+
+void Reactors::run(ReactorFn setup, ReactorFn teardown) {
+    vector <std::thread> threads;
+    for (int ii=1; ii<this->getCount(); ii++) {
+        threads.emplace_back([this, ii, &setup, &teardown]() {
+                this->runReactor(ii, setup, teardown);
+            });
+    }
+
+    auto joinAll = [this, &threads]() {
+        // reactor 0 is done, take the rest down with it
+        this->shutdown();
+        for (auto& t : threads) {
+            t.join();
+        }
+    };
+
+    try {
+        this->runReactor(0, setup, teardown);
+
+    } catch (...) {
+        joinAll();
+        throw;
+    }
+
+    joinAll();
+}
+
+void Reactors::shutdown() {
+    for (auto& scheduler : this->schedulers) {
+        Scheduler* s = scheduler.get();
+        s->post([s]() {
+                s->shutdown();
+            });
+    }
+}
+
+void Reactors::runReactor(int index, ReactorFn& setup, ReactorFn& teardown) {
+    if (this->first_cpu >= 0) {
+        const int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET((this->first_cpu + index) % cpus, &cpuset);
+
+        int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        if (res != 0) {
+            K273::l_warning("Reactor %d: failed to set affinity: %s", index, strerror(res));
+        }
+    }
+
+    Scheduler* scheduler = this->getScheduler(index);
+    TRACE("Reactor %d: running", index);
+
+    try {
+        setup(scheduler, index);
+        scheduler->run();
+
+        if (teardown) {
+            teardown(scheduler, index);
+        }
+
+    } catch (const K273::Exception& exc) {
+        // one down, all down
+        K273::l_critical("Reactor %d: exception: %s", index, exc.getMessage().c_str());
+        this->shutdown();
+
+        if (index == 0) {
+            throw;
+        }
+    }
+
+    TRACE("Reactor %d: done", index);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// local includes
+#include "kelvin/selector.h"
+#include "kelvin/scheduler.h"
+
+// std includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+namespace Kelvin {
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// N reactors, each a thread owning its own Selector and Scheduler.  Nothing is shared
+    /// between them - a connection stays on the reactor that created/accepted it.  To share
+    /// a listening port, create a server per reactor with SO_REUSEPORT (see
+    /// Streamer::tcpConfigHelper()) and the kernel balances accepts between them.  Otherwise
+    /// hand work (ie fds) to a reactor via getScheduler(ii)->post().
+    ///
+    /// Reactor 0 runs on the thread calling run(), and is the only one with an interrupt
+    /// handler.  When it shuts down so do the rest.
+
+    class Reactors {
+    public:
+        /// called on the reactor's own thread, before it runs (setup) and after it has been
+        /// shutdown (teardown)
+        typedef std::function <void (Scheduler*, int index)> ReactorFn;
+
+    public:
+        Reactors(int count, const std::string& selector_name="epoll",
+                 bool interrupt_handler=true);
+        ~Reactors();
+
+    public:
+        int getCount() const {
+            return (int) this->schedulers.size();
+        }
+
+        Scheduler* getScheduler(int index) {
+            return this->schedulers[index].get();
+        }
+
+        /// pin reactor ii to cpu (first_cpu + ii) % number of cpus.  Call before run().
+        void setAffinity(int first_cpu);
+
+        /// blocks until all reactors are shutdown
+        void run(ReactorFn setup, ReactorFn teardown=nullptr);
+
+        /// thread safe
+        void shutdown();
+
+    private:
+        void runReactor(int index, ReactorFn& setup, ReactorFn& teardown);
+
+    private:
+        std::vector <std::unique_ptr <Selector>> selectors;
+        std::vector <std::unique_ptr <Scheduler>> schedulers;
+
+        // -1 not pinned
+        int first_cpu;
+    };
+
+}
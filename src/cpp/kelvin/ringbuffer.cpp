@@ -0,0 +1,110 @@
+// local includes
+#include "kelvin/ringbuffer.h"
+
+// k273 includes
+#include <k273/logging.h>
+#include <k273/exception.h>
+
+// std includes
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+///////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const bool _debug_log = false;
+#define TRACE(fmt, args...) if (_debug_log) { K273::l_debug(fmt, ## args); }
+
+///////////////////////////////////////////////////////////////////////////////
+
+size_t RingBuffer::sizeFor(size_t capacity) {
+    size_t size = sysconf(_SC_PAGESIZE);
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+RingBuffer::RingBuffer(size_t capacity) :
+    base(nullptr),
+    size(RingBuffer::sizeFor(capacity)),
+    read_index(0),
+    write_index(0) {
+
+    this->base = RingBuffer::mapRing(this->size);
+}
+
+RingBuffer::~RingBuffer() {
+    RingBuffer::unmapRing(this->base, this->size);
+}
+
+void RingBuffer::grow(size_t new_capacity) {
+    const size_t new_size = RingBuffer::sizeFor(new_capacity);
+    if (new_size <= this->size) {
+        return;
+    }
+
+    TRACE("RingBuffer::grow() %zu -> %zu", this->size, new_size);
+
+    char* new_base = RingBuffer::mapRing(new_size);
+
+    const size_t count = this->readable();
+    std::memcpy(new_base, this->readPtr(), count);
+
+    RingBuffer::unmapRing(this->base, this->size);
+
+    this->base = new_base;
+    this->size = new_size;
+    this->read_index = 0;
+    this->write_index = count;
+}
+
+char* RingBuffer::mapRing(size_t size) {
+    int fd = memfd_create("kelvin_ring", MFD_CLOEXEC);
+    if (fd == -1) {
+        throw K273::SysException("RingBuffer memfd_create()", errno);
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        ::close(fd);
+        throw K273::SysException("RingBuffer ftruncate()", errno);
+    }
+
+    // reserve twice the address space, then map the same pages into both halves
+    void* reserved = mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        ::close(fd);
+        throw K273::SysException("RingBuffer mmap() reserve", errno);
+    }
+
+    char* base = static_cast <char*> (reserved);
+    for (int ii=0; ii<2; ii++) {
+        void* ptr = mmap(base + ii * size, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_FIXED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            int err = errno;
+            munmap(base, 2 * size);
+            ::close(fd);
+            throw K273::SysException("RingBuffer mmap() ring", err);
+        }
+    }
+
+    // the mappings keep the memory alive
+    ::close(fd);
+    return base;
+}
+
+void RingBuffer::unmapRing(char* base, size_t size) {
+    if (base != nullptr) {
+        munmap(base, 2 * size);
+    }
+}
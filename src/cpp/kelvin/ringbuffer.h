@@ -0,0 +1,77 @@
+#pragma once
+
+// std includes
+#include <cstddef>
+#include <cstdint>
+
+namespace Kelvin {
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Byte ring mapped twice back to back in virtual memory, so both the readable and the
+    /// writable regions are always contiguous - no wrapping, and nothing ever needs compacting.
+    /// Capacity is a power of 2 multiple of the page size.
+
+    class RingBuffer {
+    public:
+        RingBuffer(size_t capacity);
+        ~RingBuffer();
+
+        RingBuffer(const RingBuffer&) = delete;
+        RingBuffer& operator=(const RingBuffer&) = delete;
+
+    public:
+        size_t capacity() const {
+            return this->size;
+        }
+
+        // writer side
+        char* writePtr() {
+            return this->base + (this->write_index & (this->size - 1));
+        }
+
+        size_t writable() const {
+            return this->size - this->readable();
+        }
+
+        void produced(size_t count) {
+            this->write_index += count;
+        }
+
+        // reader side
+        char* readPtr() {
+            return this->base + (this->read_index & (this->size - 1));
+        }
+
+        size_t readable() const {
+            return this->write_index - this->read_index;
+        }
+
+        void consume(size_t count) {
+            this->read_index += count;
+        }
+
+        void clear() {
+            this->read_index = this->write_index = 0;
+        }
+
+        /// remaps at (at least) new_capacity, keeping readable data
+        void grow(size_t new_capacity);
+
+        /// the capacity actually mapped for a requested capacity
+        static size_t sizeFor(size_t capacity);
+
+    private:
+        static char* mapRing(size_t size);
+        static void unmapRing(char* base, size_t size);
+
+    private:
+        char* base;
+        size_t size;
+
+        // free running, masked on access
+        uint64_t read_index;
+        uint64_t write_index;
+    };
+
+}
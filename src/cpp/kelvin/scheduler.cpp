@@ -7,10 +7,12 @@
 
 // std includes
 #include <string>
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <sys/signalfd.h>
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -27,6 +29,9 @@ static const bool _debug_log = false;
 
 #define SLEEP_MSECS 60 * 1000
 
+// max posted callables run per loop, so busy posters can't starve I/O
+#define POST_BUDGET 1024
+
 ///////////////////////////////////////////////////////////////////////////////
 
 uint64_t msecs_time() {
@@ -35,11 +40,11 @@ uint64_t msecs_time() {
 ///////////////////////////////////////////////////////////////////////////////
 
 Deferred::Deferred(Scheduler* scheduler, int a_priority) :
-    timer(nullptr),
-    priority(a_priority),
+    timer(this, a_priority),
     scheduler(scheduler) {
 
-    ASSERT (priority >= 0);
+    ASSERT_MSG (a_priority >= 0 && a_priority < DEFERRED_PRIORITIES,
+                K273::fmtString("Deferred priority out of range: %d", a_priority));
 }
 
 Deferred::~Deferred() {
@@ -54,39 +59,28 @@ void Deferred::callLater(int msecs, bool reset) {
     if (reset) {
         // if reseting - we first cancel (which if active will cancel timer) and redo.
         this->cancel();
-        this->scheduler->callLater(msecs, this->getTimer());
+        this->scheduler->callLater(msecs, &this->timer);
 
     } else {
         // if not reseting - and active, we don't do anything.
         if (!this->active()) {
-            this->scheduler->callLater(msecs, this->getTimer());
+            this->scheduler->callLater(msecs, &this->timer);
         }
     }
 }
 
 void Deferred::cancel() {
-    // if the timer is active, it is not null.  And it therefore must be scheduled.
-    if (this->timer != nullptr) {
-        this->timer->cancel();
-
-        // the scheduler will delete the memory when the timer expires
-        this->timer = nullptr;
-    }
+    // O(1) unlink from the scheduler
+    this->timer.cancel();
 }
 
 bool Deferred::active() {
-    return this->timer != nullptr;
-}
-
-Timer* Deferred::getTimer() {
-    TRACE("creating timer in %s", this->repr().c_str());
-    this->timer = new Timer(this, this->priority);
-    return this->timer;
+    return this->timer.scheduled();
 }
 
 void Deferred::onWakeupFromScheduler() {
-    // we need to set this first, incase we reschedule ourselves
-    this->timer = nullptr;
+    // the scheduler has already unlinked the timer, so we can reschedule ourselves
+    ASSERT (!this->timer.scheduled());
     this->onWakeup();
 }
 
@@ -120,33 +114,6 @@ string EventHandler::repr() const {
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Timer::Timer(Deferred* a_deferred, unsigned int a_priority) :
-    deferred(a_deferred),
-    scheduled(false),
-    priority(a_priority),
-    trigger_at_time(-1),
-    next_timer(nullptr) {
-}
-
-Timer::~Timer() {
-}
-
-string Timer::repr() const {
-    if (this->deferred == nullptr) {
-        return "Timer(handler=null)";
-
-    } else if (this->trigger_at_time == 0) {
-        return K273::fmtString("Timer0(handler=%s)", this->deferred->repr().c_str());
-
-    } else {
-        return K273::fmtString("Time(handler=%s, trigger_time=%d)",
-                               this->deferred->repr().c_str(),
-                               this->trigger_at_time);
-    }
-}
-
-///////////////////////////////////////////////////////////////////////////////
-
 InterruptHandler::InterruptHandler(Scheduler* scheduler) :
     scheduler(scheduler) {
     sigemptyset(&this->sset);
@@ -189,20 +156,90 @@ string InterruptHandler::repr() const {
 
 ///////////////////////////////////////////////////////////////////////////////
 
-Scheduler::Scheduler(Selector* selector) :
+PollSource::PollSource() {
+}
+
+PollSource::~PollSource() {
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+WakeupHandler::WakeupHandler() {
+    if ((this->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        throw K273::SysException("creating eventfd()", errno);
+    }
+}
+
+WakeupHandler::~WakeupHandler() {
+    close(this->efd);
+}
+
+void WakeupHandler::doRead(SelectionKey* key) {
+    ASSERT(key->fileno() == this->efd);
+
+    // just resets the counter, the scheduler runs whatever was posted after handling the keys
+    uint64_t count;
+    int bytes = read(this->efd, &count, sizeof(count));
+    if (bytes < 0 && errno != EAGAIN) {
+        throw K273::SysException("Failed to read from efd", errno);
+    }
+}
+
+void WakeupHandler::wakeup() {
+    uint64_t one = 1;
+    int bytes = write(this->efd, &one, sizeof(one));
+
+    // EAGAIN means the counter is saturated, which is still a wakeup
+    if (bytes < 0 && errno != EAGAIN) {
+        throw K273::SysException("Failed to write to efd", errno);
+    }
+}
+
+string WakeupHandler::repr() const {
+    return "WakeupHandler";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+Scheduler::Scheduler(Selector* selector, bool interrupt_handler) :
+    input_pool(SlabPool::DEFAULT_SLAB_SIZE),
+    output_pool(),
     running(false),
     interrupt_handler(nullptr),
+    wakeup_handler(new WakeupHandler),
+    sleeping(false),
     selector(selector),
-    call_laters(nullptr) {
-
     // we need to set this at creation time incase anyone adds a callLater
     // before we start the main loop
-    this->last_select_time = msecs_time();
-    this->setInterruptHandler();
+    last_select_time(msecs_time()),
+    timers(last_select_time),
+    call_laters_bits(0),
+    poll_sources_armed(false),
+    poll_idle_msecs(10),
+    poll_max_block_msecs(SLEEP_MSECS),
+    last_poll_source_time(last_select_time) {
+
+    for (int ii=0; ii<DEFERRED_PRIORITIES; ii++) {
+        this->call_laters[ii].initList();
+    }
+
+    if (interrupt_handler) {
+        this->setInterruptHandler();
+    }
+
+    this->registerHandler(this->wakeup_handler, this->wakeup_handler->efd, OP_READ);
 }
 
 Scheduler::~Scheduler() {
     delete this->interrupt_handler;
+
+    this->registerHandler(this->wakeup_handler, this->wakeup_handler->efd, 0);
+    delete this->wakeup_handler;
+
+    // Deferreds may outlive us
+    for (int ii=0; ii<DEFERRED_PRIORITIES; ii++) {
+        this->call_laters[ii].unlinkAll();
+    }
 }
 
 
@@ -225,45 +262,62 @@ SelectionKey* Scheduler::registerHandler(EventHandler* handler, int fd, int inte
 }
 
 void Scheduler::callLater(int msecs, Timer* timer) {
-    /* The deallocation of Timers are handled internally.
+    /* Timers are embedded in Deferreds, there is no allocation here.
 
        If the msecs is 0, it will be given priority over the timed events and added to
-       call_laters deque on a priority basis. */
-
-    ASSERT(!timer->scheduled);
+       call_laters on a priority basis. */
 
-    timer->scheduled = true;
+    ASSERT(!timer->scheduled());
 
     if (msecs == 0) {
         timer->trigger_at_time = 0;
 
-        Timer* prev = nullptr;
-        Timer* cur = this->call_laters;
-        while (true) {
-            // insert before
-            if (cur == nullptr || timer->priority > cur->priority) {
-                timer->next_timer = cur;
-
-                // is this the front?
-                if (prev == nullptr) {
-                    this->call_laters = timer;
-                } else {
-                    prev->next_timer = timer;
-                }
+        // O(1), FIFO within a priority
+        this->call_laters[timer->priority].pushBack(timer);
+        this->call_laters_bits |= uint64_t(1) << timer->priority;
 
-                break;
-            }
+    } else {
+        this->timers.add(timer, this->last_select_time + msecs);
+    }
+}
 
-            prev = cur;
-            cur = cur->next_timer;
-        }
+void Scheduler::post(std::function <void()> fn) {
+    this->posted.push(std::move(fn));
 
-    } else {
-        timer->trigger_at_time = this->last_select_time + msecs;
-        this->timers.push(timer);
+    // only the first poster to see the scheduler sleeping pays for the syscall
+    if (this->sleeping.load(std::memory_order_seq_cst) &&
+        this->sleeping.exchange(false, std::memory_order_seq_cst)) {
+        this->wakeup_handler->wakeup();
     }
 }
 
+void Scheduler::addPollSource(PollSource* source) {
+    ASSERT (std::find(this->poll_sources.begin(), this->poll_sources.end(), source) ==
+            this->poll_sources.end());
+
+    this->poll_sources.push_back(source);
+
+    // start off busy
+    this->last_poll_source_time = this->last_select_time;
+}
+
+void Scheduler::removePollSource(PollSource* source) {
+    auto it = std::find(this->poll_sources.begin(), this->poll_sources.end(), source);
+    ASSERT (it != this->poll_sources.end());
+
+    if (this->poll_sources_armed) {
+        source->disarmWakeup();
+    }
+
+    this->poll_sources.erase(it);
+}
+
+void Scheduler::setPollSourceTimeouts(int idle_msecs, int max_block_msecs) {
+    ASSERT (idle_msecs >= 0 && max_block_msecs >= 0);
+    this->poll_idle_msecs = idle_msecs;
+    this->poll_max_block_msecs = max_block_msecs;
+}
+
 void Scheduler::run(bool polling_mode) {
     this->running = true;
     if (!polling_mode) {
@@ -278,81 +332,118 @@ void Scheduler::shutdown() {
 ///////////////////////////////////////////////////////////////////////////////
 
 void Scheduler::scheduleLatersZero() {
-    while (this->call_laters != nullptr) {
+    while (this->call_laters_bits != 0) {
 
         // very useful for debugging purposes.  Note only on verbose, but not when tracing.  It is too much debug.
         if (_debug_log) {
             string s = "";
-            Timer* cur = this->call_laters;
-            while (cur != nullptr) {
-                s += cur->repr();
-                cur = cur->next_timer;
-                if (cur != nullptr) {
-                    s += ", ";
+            for (int ii=DEFERRED_PRIORITIES - 1; ii>=0; ii--) {
+                Timer* head = &this->call_laters[ii];
+                for (Timer* cur = head->next; cur != head; cur = cur->next) {
+                    if (!s.empty()) {
+                        s += ", ";
+                    }
+
+                    s += cur->repr();
                 }
             }
 
             K273::l_debug("SCHEDULER:callLaters(0) -> %s", s.c_str());
         }
 
-        // get the head
-        Timer* timer = this->call_laters;
+        // highest priority first
+        const int priority = 63 - __builtin_clzll(this->call_laters_bits);
+        Timer* head = &this->call_laters[priority];
 
-        // take a copy of deferred, we want to reset the timer before calling wakeup
-        Deferred* the_deferred = timer->deferred;
+        if (head->listEmpty()) {
+            // stale, everything in it was canceled
+            this->call_laters_bits &= ~(uint64_t(1) << priority);
+            continue;
+        }
 
-        // this effectively pops the head
-        this->call_laters = timer->next_timer;
+        // pops the head (and unlinks, so the deferred can reschedule itself)
+        Timer* timer = head->popFront();
+        if (head->listEmpty()) {
+            this->call_laters_bits &= ~(uint64_t(1) << priority);
+        }
 
-        // cleans up memory
-        delete timer;
+        timer->deferred->onWakeupFromScheduler();
+    }
+}
 
-        // finally call (the null test is since a cancelled callLater() will set the_deferred to be null)
-        if (the_deferred != nullptr) {
-            the_deferred->onWakeupFromScheduler();
-        }
+void Scheduler::runPosted() {
+    std::function <void()> fn;
+    for (int ii=0; ii<POST_BUDGET && this->posted.pop(fn); ii++) {
+        fn();
     }
 }
 
-int Scheduler::scheduleLaters() {
+void Scheduler::runLaters() {
+    this->runPosted();
 
-    while (this->call_laters != nullptr || !this->timers.empty()) {
+    this->timers.advance(this->last_select_time);
 
-        if (this->call_laters != nullptr) {
+    while (true) {
+        if (this->call_laters_bits != 0) {
             this->scheduleLatersZero();
             continue;
         }
 
-        Timer* timer = this->timers.top();
+        Timer* timer = this->timers.popExpired();
+        if (timer == nullptr) {
+            break;
+        }
 
-        // check if the timer is still associated with the Timer, and if not we can just continue.
-        if (timer->deferred == nullptr) {
-            this->timers.pop();
+        timer->deferred->onWakeupFromScheduler();
+    }
+}
 
-            // cleans up memory
-            delete timer;
+int Scheduler::scheduleLaters() {
+    this->runLaters();
 
-        } else {
-            const int timeout_msecs = timer->trigger_at_time - this->last_select_time;
-            if (timeout_msecs > 0) {
-                //l_debug("Scheduler::scheduleTimers() size: %zu", this->timers.size());
-                return timeout_msecs;
-            }
+    int timeout_msecs = this->timers.nextTimeout(this->last_select_time);
+    if (timeout_msecs < 0 || timeout_msecs > SLEEP_MSECS) {
+        return SLEEP_MSECS;
+    }
 
-            this->timers.pop();
+    return timeout_msecs;
+}
 
-            // take a copy of deferred, we want to reset the timer before calling wakeup
-            Deferred* the_deferred = timer->deferred;
+int Scheduler::runPollSources(int timeout_msecs) {
+    // returns the timeout to use for the selector
 
-            // cleans up memory
-            delete timer;
+    int handled = 0;
+
+    // by index, as a source may remove itself
+    for (size_t ii=0; ii<this->poll_sources.size(); ii++) {
+        handled += this->poll_sources[ii]->pollSource();
+    }
+
+    if (handled > 0) {
+        this->last_poll_source_time = this->last_select_time;
+        return 0;
+    }
+
+    // still spinning
+    if (timeout_msecs == 0 ||
+        this->last_select_time - this->last_poll_source_time < (uint64_t) this->poll_idle_msecs) {
+        return 0;
+    }
 
-            // finally call
-            the_deferred->onWakeupFromScheduler();
+    // idle, going to block.  All are armed (and disarmed after the select), even if one
+    // already has something.
+    this->poll_sources_armed = true;
+    for (PollSource* source : this->poll_sources) {
+        if (!source->armWakeup()) {
+            timeout_msecs = 0;
         }
     }
 
-    return SLEEP_MSECS;
+    if (timeout_msecs < 0 || timeout_msecs > this->poll_max_block_msecs) {
+        timeout_msecs = this->poll_max_block_msecs;
+    }
+
+    return timeout_msecs;
 }
 
 int Scheduler::poll(int timeout_msecs) {
@@ -361,8 +452,31 @@ int Scheduler::poll(int timeout_msecs) {
         return -1;
     }
 
+    if (!this->poll_sources.empty()) {
+        timeout_msecs = this->runPollSources(timeout_msecs);
+    }
+
+    if (timeout_msecs != 0) {
+        // Dekker style with post(): either we see the posted fn here, or the poster sees
+        // sleeping and writes the eventfd
+        this->sleeping.store(true, std::memory_order_seq_cst);
+        if (!this->posted.empty()) {
+            timeout_msecs = 0;
+        }
+    }
+
     int ready_count = selector->doSelect(timeout_msecs);
 
+    this->sleeping.store(false, std::memory_order_relaxed);
+
+    if (this->poll_sources_armed) {
+        for (PollSource* source : this->poll_sources) {
+            source->disarmWakeup();
+        }
+
+        this->poll_sources_armed = false;
+    }
+
     TRACE("selector->doSelect() readycount %d", ready_count);
 
     this->last_select_time = msecs_time();
@@ -2,11 +2,16 @@
 
 // local includes
 #include "kelvin/selector.h"
+#include "kelvin/timerwheel.h"
+#include "kelvin/mpsc.h"
+#include "kelvin/slabpool.h"
+#include "kelvin/outchain.h"
 
 // std includes
-#include <queue>
+#include <atomic>
 #include <vector>
 #include <cstdint>
+#include <functional>
 
 namespace Kelvin {
 
@@ -18,48 +23,8 @@ namespace Kelvin {
 
     ///////////////////////////////////////////////////////////////////////////
 
-    /// Timers are used internally within the scheduler to callback a Deferred object.  It is
-    /// mainly an implementation detail, and not a public class.
-    class Timer {
-    public:
-        Timer(Deferred* deferred, unsigned int priority);
-        ~Timer();
-
-    public:
-        /// Called from deferred.  Cancels the timer from the scheduler.  Note Timer must be in a valid state (ie in the scheduler, and set with a
-        /// deferred).
-        void cancel() {
-            this->deferred = nullptr;
-        }
-
-        std::string repr() const;
-
-    private:
-        /// the deferred associated with this Timer, will be null if not associated.
-        Deferred* deferred;
-
-        /// this timer in the scheduled queue (and cannot be reused by a deferred)
-        bool scheduled;
-
-        /// priority for callLater(0)s
-        const unsigned int priority;
-
-        /// time to trigger at (for callLater non zeros)
-        uint64_t trigger_at_time;
-
-        /// is a single linked list - for use in scheduler.call_laters
-        Timer* next_timer;
-
-    public:
-        struct greaterthan {
-            bool operator() (const Timer* t1, const Timer* t2) const {
-                return t1->trigger_at_time > t2->trigger_at_time;
-            }
-        };
-
-    private:
-        friend class Scheduler;
-    };
+    /// priorities for callLater(0)s are 0 .. DEFERRED_PRIORITIES - 1 (higher called back first)
+    constexpr int DEFERRED_PRIORITIES = 64;
 
     ///////////////////////////////////////////////////////////////////////////
 
@@ -93,19 +58,13 @@ namespace Kelvin {
         bool active();
 
     private:
-        /// private, creates and setups a timer to be scheduled.
-        Timer* getTimer();
-
         /// Internal method that is only called from scheduled.  Ultimately calls onWakeup().
         void onWakeupFromScheduler();
 
     private:
 
-        /// if this is set, it means that we have actively registered with the scheduler to be called back later.  Otherwise null.
-        Timer* timer;
-
-        /// the priority of this deferred
-        const unsigned int priority;
+        /// embedded (intrusive) timer, scheduled while we are registered with the scheduler to be called back later.
+        Timer timer;
 
         /// We need a reference to scheduler.
         Scheduler* scheduler;
@@ -158,12 +117,53 @@ namespace Kelvin {
 
     ///////////////////////////////////////////////////////////////////////////
 
-    class Scheduler {
-    private:
-        typedef std::priority_queue <Timer*, std::vector <Timer*>, Timer::greaterthan > TimerHeap;
+    class PollSource {
+        /* something polled by the scheduler between selector passes, rather than waking it
+           via a file descriptor (ie a MsgQ consumer, see kelvin/msgq/source.h). */
+
+      public:
+        PollSource();
+        virtual ~PollSource() = 0;
+
+      public:
+        /// handle what is available (should be bounded), returns the number of items handled
+        virtual int pollSource() = 0;
+
+        /// the scheduler is about to block.  Have producers wake it (via an fd registered with
+        /// the scheduler).  Return false if there is already something to handle.
+        virtual bool armWakeup() = 0;
+        virtual void disarmWakeup() = 0;
+
+        virtual std::string repr() const = 0;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    class WakeupHandler : public EventHandler {
+        /* eventfd used by other threads to wake a sleeping scheduler (see Scheduler::post()).
+           automatically installed. */
+
+      public:
+        WakeupHandler();
+        virtual ~WakeupHandler();
+
+      public:
+        virtual void doRead(SelectionKey* key);
+        virtual std::string repr() const;
 
+        // any thread
+        void wakeup();
+
+      public:
+        int efd;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    class Scheduler {
     public:
-        Scheduler(Selector* selector);
+        // only one scheduler per process should handle interrupts (see Reactors)
+        Scheduler(Selector* selector, bool interrupt_handler=true);
         ~Scheduler();
 
     public:
@@ -196,32 +196,84 @@ namespace Kelvin {
         // a valid timer must be passed in (ie it must not already be scheduled).
         void callLater(int msecs, Timer* timer);
 
-        bool callScheduleLaters() {
-            if (this->call_laters != nullptr || !this->timers.empty()) {
-                this->scheduleLaters();
-            }
+        /// Thread safe.  Queues fn to be called on the scheduler's thread (before any timers are
+        /// called back).  The scheduler is woken via an eventfd, but only if it is sleeping in
+        /// the selector - so a busy scheduler costs the poster one exchange and one load.
+        void post(std::function <void()> fn);
+
+        /// the eventfd that wakes the scheduler (same process producers only)
+        int getWakeupFd() const {
+            return this->wakeup_handler->efd;
+        }
+
+        /// Buffer pools for handlers of this scheduler (connection input slabs, pending output
+        /// segments).  Not thread safe, and outlive every handler - so handlers must be
+        /// destroyed on the scheduler's thread, before the scheduler.
+        SlabPool& getInputPool() {
+            return this->input_pool;
+        }
+
+        SegmentPool& getOutputPool() {
+            return this->output_pool;
+        }
 
+        /*
+          Poll sources are polled on every pass, and while any of them has been busy in the
+          last idle_msecs the selector is only polled (zero timeout).  After that the scheduler
+          arms the sources wakeups and blocks, but for no longer than max_block_msecs (for
+          producers that can't wake us).
+        */
+
+        void addPollSource(PollSource* source);
+        void removePollSource(PollSource* source);
+        void setPollSourceTimeouts(int idle_msecs, int max_block_msecs);
+
+        bool callScheduleLaters() {
+            this->runLaters();
             return this->running;
         }
 
     private:
+        void runPosted();
+        int runPollSources(int timeout_msecs);
         void scheduleLatersZero();
+        void runLaters();
         int scheduleLaters();
 
         void mainLoop();
 
     private:
+        // first, so destroyed last
+        SlabPool input_pool;
+        SegmentPool output_pool;
+
         bool running;
 
         InterruptHandler* interrupt_handler;
 
+        // cross thread post(), sleeping is set (seq_cst) just before blocking in the selector
+        // and checked (seq_cst) by posters after pushing.  One of them will see the other.
+        WakeupHandler* wakeup_handler;
+        MPSCQueue <std::function <void()>> posted;
+        std::atomic <bool> sleeping;
+
         Selector* selector;
         unsigned long long last_select_time;
 
-        TimerHeap timers;
+        TimerWheel timers;
+
+        // callLater(0)s, a FIFO per priority (each Timer is the list's sentinel), and a bitmap of
+        // the non empty ones.  Bits may be stale after a cancel.
+        Timer call_laters[DEFERRED_PRIORITIES];
+        uint64_t call_laters_bits;
+        static_assert(DEFERRED_PRIORITIES <= 64, "call_laters_bits is a uint64_t");
 
-        // this is a single linked list
-        Timer* call_laters;
+        // see addPollSource()
+        std::vector <PollSource*> poll_sources;
+        bool poll_sources_armed;
+        int poll_idle_msecs;
+        int poll_max_block_msecs;
+        uint64_t last_poll_source_time;
     };
 }
 
@@ -1,5 +1,8 @@
 // local includes
 #include "kelvin/selector.h"
+#include "kelvin/selector_poll.h"
+#include "kelvin/selector_epoll.h"
+#include "kelvin/selector_uring.h"
 
 // k273 includes
 #include <k273/logging.h>
@@ -7,6 +10,7 @@
 
 // std includes
 #include <cstring>
+#include <algorithm>
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -31,6 +35,11 @@ SelectionKey::SelectionKey(int fd, int ops, Selector* selector, void* ptdata) :
     fd(fd),
     readyops(0),
     canceled(false),
+    pending_removal(false),
+    index(-1),
+    edge_triggered(false),
+    edge_pending(false),
+    edge_ready(0),
     selector(selector),
     ptdata(ptdata) {
     ASSERT (ops != 0);
@@ -54,7 +63,7 @@ void SelectionKey::cancel() {
     if (!this->canceled) {
         this->ops = 0;
         this->canceled = true;
-        this->selector->cancelIncrement();
+        this->selector->cancelIncrement(this);
     }
 }
 
@@ -106,67 +115,140 @@ string SelectionKey::repr() const {
 Selector::Selector() :
     number_keys(0),
     canceled_count(0) {
-    std::memset(this->keys, 0, sizeof(SelectionKey*) * SELECTOR_MAX_FDS);
-    std::memset(this->ready, 0, sizeof(SelectionKey*) * SELECTOR_MAX_FDS);
 }
 
 Selector::~Selector() {
 }
 
+Selector* Selector::create(const string& name) {
+    if (name == "poll") {
+        return new PollSelector;
+
+    } else if (name == "epoll") {
+        return new EPollSelector;
+
+    } else if (name == "epoll_et") {
+        return new EPollSelector(1024, true);
+
+    } else if (name == "uring") {
+        try {
+            return new UringSelector;
+
+        } catch (const SelectorError& exc) {
+            K273::l_warning("io_uring not available, falling back to epoll: %s",
+                            exc.getMessage().c_str());
+            return new EPollSelector;
+        }
+    }
+
+    throw SelectorError(K273::fmtString("Unknown selector: '%s'", name.c_str()));
+}
+
 int Selector::getKeyCount() {
     return this->number_keys;
 }
 
 SelectionKey** Selector::getReadyKeys() {
-    return this->ready;
+    return this->ready.data();
+}
+
+SelectionKey* Selector::registerInterests(int fd, int ops, void* ptdata) {
+    /* will register an interest for a file descriptor */
+
+    TRACE("Selector::registerInterests() fd: %d, ops: %d, number_keys: %d", fd, ops, this->number_keys);
+
+    SelectionKey* ptkey = this->lookupKey(fd);
+    if (ptkey != nullptr) {
+
+        // update ops and data
+        if (ops) {
+            ptkey->setOps(ops);
+        } else {
+            ptkey->cancel();
+        }
+
+        ptkey->ptdata = ptdata;
+        return ptkey;
+    }
+
+    if (ops == 0) {
+        return nullptr;
+    }
+
+    ASSERT (fd >= 0);
+    if (fd >= (int) this->fd_keys.size()) {
+        // double, to keep growing amortised O(1)
+        size_t new_size = std::max((size_t) fd + 1, this->fd_keys.size() * 2);
+        this->fd_keys.resize(new_size, nullptr);
+    }
+
+    ptkey = new SelectionKey(fd, ops, this, ptdata);
+    this->addInterest(ptkey);
+
+    this->fd_keys[fd] = ptkey;
+    this->number_keys++;
+
+    TRACE("Selector::registerInterests() / new registration key: %s number_keys: %d",
+          ptkey->repr().c_str(), this->number_keys);
+
+    return ptkey;
 }
 
-void Selector::cancelIncrement() {
+void Selector::cancelIncrement(SelectionKey* ptkey) {
     this->canceled_count++;
-    TRACE("PollSelector::cancelIncrement() %d", this->canceled_count);
+
+    // a revived and re-canceled key is only listed once
+    if (!ptkey->pending_removal) {
+        ptkey->pending_removal = true;
+        this->canceled.push_back(ptkey);
+    }
+
+    TRACE("Selector::cancelIncrement() %d", this->canceled_count);
 }
 
 void Selector::cancelDecrement() {
     this->canceled_count--;
-    TRACE("PollSelector::cancelDecrement() %d", this->canceled_count);
+    TRACE("Selector::cancelDecrement() %d", this->canceled_count);
 }
 
 void Selector::removeCanceled() {
     ASSERT (this->canceled_count > 0);
 
+    // only touches the canceled keys, not all of them
     int found = 0;
-    SelectionKey** prev = nullptr;
-    for (int ii=0; ii<this->number_keys; ii++) {
-        SelectionKey* ptkey = this->keys[ii];
-        if (ptkey->canceled) {
-            TRACE("PollSelector::removeCanceled() key: %s pos: %d",
-                  ptkey->repr().c_str(), ii);
+    for (SelectionKey* ptkey : this->canceled) {
+        ptkey->pending_removal = false;
 
-            this->finalizeInterest(ptkey);
+        // revived via setOps() since being canceled
+        if (!ptkey->canceled) {
+            continue;
+        }
 
-            ptkey->canceled = false;
-            ptkey->selector = nullptr;
+        TRACE("Selector::removeCanceled() key: %s", ptkey->repr().c_str());
 
-            delete ptkey;
+        this->finalizeInterest(ptkey);
 
-            if (prev == nullptr) {
-                prev = &this->keys[ii];
-            }
+        ASSERT (this->fd_keys[ptkey->fd] == ptkey);
+        this->fd_keys[ptkey->fd] = nullptr;
 
-            found++;
+        ptkey->canceled = false;
+        ptkey->selector = nullptr;
 
-        } else {
-            // compacting up
-            if (prev != nullptr) {
-                *prev = ptkey;
-                prev++;
-            }
-        }
+        delete ptkey;
+
+        found++;
     }
 
     ASSERT (found == this->canceled_count);
+    this->canceled.clear();
     this->canceled_count = 0;
     this->number_keys -= found;
+}
+
+SelectionKey** Selector::readyBuffer(int count) {
+    if (count > (int) this->ready.size()) {
+        this->ready.resize(count, nullptr);
+    }
 
-    this->updateSelectionKeys();
+    return this->ready.data();
 }
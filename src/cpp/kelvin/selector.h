@@ -3,6 +3,9 @@
 // k273 includes
 #include <k273/exception.h>
 
+// std includes
+#include <vector>
+
 ///////////////////////////////////////////////////////////////////////////////
 
 #define OP_NONE 0
@@ -11,12 +14,13 @@
 #define OP_READ (1 << 2)
 #define OP_WRITE (1 << 3)
 
+// registration only: the handler drains to EAGAIN (and calls SelectionKey::drained()), so the key
+// may be edge triggered if the selector is in edge triggered mode.  Ignored otherwise.
+#define OP_EDGE (1 << 4)
+
 #define KEY_READ (OP_ACCEPT | OP_READ)
 #define KEY_WRITE (OP_CONNECT | OP_WRITE)
 
-// XXX Why this max???
-#define SELECTOR_MAX_FDS 128
-
 namespace Kelvin {
 
     ///////////////////////////////////////////////////////////////////////////
@@ -26,6 +30,7 @@ namespace Kelvin {
     class Selector;
     class PollSelector;
     class EPollSelector;
+    class UringSelector;
 
     // from scheduler
     class Scheduler;
@@ -60,6 +65,22 @@ namespace Kelvin {
 
         void reset();
 
+        // edge triggered keys: the handler got EAGAIN (or a short read/write) for ops.  Until
+        // then the selector keeps re-delivering the key.  No-op for level triggered keys.
+        void drained(int ops) {
+            if (ops & KEY_READ) {
+                this->edge_ready &= ~KEY_READ;
+            }
+
+            if (ops & KEY_WRITE) {
+                this->edge_ready &= ~KEY_WRITE;
+            }
+        }
+
+        bool isEdgeTriggered() const {
+            return this->edge_triggered;
+        }
+
         int fileno() const;
         void* getData() const;
 
@@ -73,6 +94,18 @@ namespace Kelvin {
         // so we increment canceled_count properly
         bool canceled;
 
+        // is in selector's canceled list (may have been revived since)
+        bool pending_removal;
+
+        // position in a subclass's dense arrays (ie PollSelector's pollfds)
+        int index;
+
+        // edge triggered state (EPollSelector).  edge_ready is readiness seen and not yet
+        // drained, as KEY_READ/KEY_WRITE bits.
+        bool edge_triggered;
+        bool edge_pending;
+        int edge_ready;
+
         Selector* selector;
 
         // store pointer to arbirtary data with this selector
@@ -82,6 +115,7 @@ namespace Kelvin {
         friend class Selector;
         friend class PollSelector;
         friend class EPollSelector;
+        friend class UringSelector;
         friend class Scheduler;
     };
 
@@ -94,43 +128,63 @@ namespace Kelvin {
         virtual ~Selector();
 
     public:
+        // creates a selector by name, "poll", "epoll", "epoll_et" or "uring".  "uring" falls back to
+        // epoll if io_uring is not available.
+        static Selector* create(const std::string& name="epoll");
+
         // getters
         int getKeyCount();
         SelectionKey** getReadyKeys();
 
-        // subclasses must implement these two
+        // O(1), nullptr if fd is not registered
+        SelectionKey* lookupKey(int fd) const {
+            if (fd < 0 || fd >= (int) this->fd_keys.size()) {
+                return nullptr;
+            }
+
+            return this->fd_keys[fd];
+        }
 
         /* There can only be one selection key per file descriptor.
            Re-registering will over-write the ops and ptdata.  When the key is
            canceled, on the next doSelect() call the SelectionKey memory will
            be deallocated. It is possible to cancel and re-register before the
-           next doSelect() and in that case the memory won't be deallocated. */
-        virtual SelectionKey* registerInterests(int fd, int ops, void* ptdata=nullptr) = 0;
+           next doSelect() and in that case the memory won't be deallocated.
+           Registering with zero ops and no existing key returns nullptr. */
+        SelectionKey* registerInterests(int fd, int ops, void* ptdata=nullptr);
 
-        // actually do the selection
+        // subclasses must implement this, actually do the selection
         virtual int doSelect(int timeout_msecs) = 0;
 
       protected:
+        // A new key has been registered
+        virtual void addInterest(SelectionKey* ptkey) = 0;
+
         // Update interest for a specific key
         virtual void updateSelectionKey(SelectionKey* ptkey) = 0;
 
-        // Update interest for all keys
-        virtual void updateSelectionKeys() = 0;
-
         // Finalize the selector and do any cleaning up for this selector
         virtual void finalizeInterest(SelectionKey* ptkey) = 0;
 
       protected:
-        void cancelIncrement();
+        void cancelIncrement(SelectionKey* ptkey);
         void cancelDecrement();
         void removeCanceled();
-        void addInterest(int fd, int ops, void* ptdata);
+
+        // makes sure ready can take count keys
+        SelectionKey** readyBuffer(int count);
 
       protected:
         int number_keys;
         int canceled_count;
-        SelectionKey* keys[SELECTOR_MAX_FDS];
-        SelectionKey* ready[SELECTOR_MAX_FDS];
+
+        // indexed by fd, grows as needed
+        std::vector <SelectionKey*> fd_keys;
+
+        // keys canceled since the last removeCanceled()
+        std::vector <SelectionKey*> canceled;
+
+        std::vector <SelectionKey*> ready;
 
       public:
         friend class SelectionKey;
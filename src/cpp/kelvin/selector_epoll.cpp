@@ -10,6 +10,7 @@
 
 // std includes
 #include <cerrno>
+#include <algorithm>
 #include <cstring>
 #include <poll.h>
 #include <unistd.h>
@@ -26,77 +27,68 @@ static const bool _debug_log = false;
 
 ///////////////////////////////////////////////////////////////////////////////
 
-EPollSelector::EPollSelector() {
+EPollSelector::EPollSelector(int max_events, bool edge_triggered) :
+    max_events(max_events),
+    edge_triggered(edge_triggered),
+    epoll_events(max_events),
+    ctl_count(0),
+    wait_count(0) {
     TRACE("EPollSelector::EPollSelector()");
-    this->epoll_fd = epoll_create(SELECTOR_MAX_FDS);
-    memset(this->epoll_events, 0, sizeof(struct epoll_event) * SELECTOR_MAX_FDS);
+    ASSERT (max_events > 0);
+
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll_fd < 0) {
+        throw K273::SysException("An error occurred during epoll_create1()", errno);
+    }
+
+    this->readyBuffer(max_events);
 }
 
 EPollSelector::~EPollSelector() {
     close(this->epoll_fd);
 }
 
-SelectionKey* EPollSelector::registerInterests(int fd, int ops, void* ptdata) {
-    /* will register an interest for a file descriptor */
-
-    // XXX common code start
-    TRACE("EPollSelector::registerInterests() fd: %d, ops: %d, number_keys: %d", fd, ops, this->number_keys);
-
-    SelectionKey** ptptkey = this->keys;
-    for (int ii=0; ii<this->number_keys; ii++, ptptkey++) {
-        SelectionKey* ptkey = *ptptkey;
-        if (ptkey->fd == fd) {
-
-            // update ops and data
-            if (ops) {
-                ptkey->setOps(ops);
-            } else {
-                ptkey->cancel();
-            }
+void EPollSelector::addInterest(SelectionKey* ptkey) {
+    ptkey->edge_triggered = this->edge_triggered && (ptkey->getOps() & OP_EDGE);
+    this->updateEpollEvent(ptkey, true);
+}
 
-            ptkey->ptdata = ptdata;
-            return ptkey;
+void EPollSelector::updateSelectionKey(SelectionKey* ptkey) {
+    // edge triggered keys are registered for everything already.  Except a canceled key being
+    // revived, which may be for a recycled fd.
+    if (ptkey->edge_triggered && !ptkey->canceled) {
+        // interested in something we already know is ready?
+        if (ptkey->edge_ready & ptkey->getOps()) {
+            this->addEdgePending(ptkey);
         }
-    }
 
-    if (this->number_keys == SELECTOR_MAX_FDS) {
-        throw SelectorError("Exceeded number of registrations");
+        return;
     }
 
-    SelectionKey* key = new SelectionKey(fd, ops, this, ptdata);
-
-    // XXX common code end
-
-    this->updateEpollEvent(key, true);
-    this->number_keys++;
-    *ptptkey = key;
-
-    TRACE("PollSelector::registerInterests() / new registration key: %s number_keys: %d",
-          key->repr().c_str(), this->number_keys);
-
-    return key;
-}
-
-void EPollSelector::updateSelectionKey(SelectionKey* ptkey) {
-    this->updateEpollEvent(ptkey, false);
-}
-
-void EPollSelector::updateSelectionKeys() {
-    for (int ii=0; ii<this->number_keys; ii++) {
-        SelectionKey* ptkey = this->keys[ii];
-        this->updateEpollEvent(ptkey, false);
+    if (ptkey->canceled) {
+        ptkey->edge_triggered = this->edge_triggered && (ptkey->getOps() & OP_EDGE);
     }
 
-    TRACE("PollSelector::updateAllInterests() updated interests (number_keys : %d)",
-          this->number_keys);
+    ptkey->edge_ready = 0;
+    this->updateEpollEvent(ptkey, false);
 }
 
 void EPollSelector::finalizeInterest(SelectionKey* ptkey) {
     TRACE("PollSelector::finalizeInterest() to fd: %d)", ptkey->fileno());
 
+    if (ptkey->edge_pending) {
+        auto it = std::find(this->edge_pending.begin(), this->edge_pending.end(), ptkey);
+        ASSERT (it != this->edge_pending.end());
+        *it = this->edge_pending.back();
+        this->edge_pending.pop_back();
+        ptkey->edge_pending = false;
+    }
+
+    this->ctl_count++;
     int res = epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, ptkey->fileno(), nullptr);
     if (res != 0) {
-        if (errno == EBADF) {
+        // already closed (and possibly fd recycled)
+        if (errno == EBADF || errno == ENOENT) {
             return;
         }
 
@@ -119,27 +111,86 @@ int EPollSelector::doSelect(int timeout_msecs) {
         return 0;
     }
 
-    int ready_count = epoll_wait(this->epoll_fd, this->epoll_events, this->number_keys, timeout_msecs);
+    // edge triggered keys not drained last time go first (and we don't block)
+    int ready_count = 0;
+    if (!this->edge_pending.empty()) {
+        SelectionKey** ptready = this->readyBuffer(this->edge_pending.size() + this->max_events);
+
+        size_t kept = 0;
+        for (SelectionKey* ptkey : this->edge_pending) {
+            const int readyops = ptkey->edge_ready & ptkey->getOps() & (KEY_READ | KEY_WRITE);
+            if (readyops == 0) {
+                // drained, or no longer interested
+                ptkey->edge_pending = false;
+                continue;
+            }
+
+            ptkey->readyops |= readyops;
+            ptready[ready_count++] = ptkey;
+            this->edge_pending[kept++] = ptkey;
+        }
+
+        this->edge_pending.resize(kept);
+
+        if (ready_count > 0) {
+            timeout_msecs = 0;
+        }
+    }
+
+    this->wait_count++;
+    int event_count = epoll_wait(this->epoll_fd, this->epoll_events.data(), this->max_events, timeout_msecs);
 
-    TRACE("EPollSelector::doSelect() ready_count: %d ", ready_count);
+    TRACE("EPollSelector::doSelect() event_count: %d ", event_count);
 
-    if (ready_count < 0) {
+    if (event_count < 0) {
         if (errno == EINTR) {
             // A signal occurred before any requested events
-            return 0;
+            return ready_count;
         }
 
         throw K273::SysException("An error occurred during epoll()", errno);
     }
 
-    ASSERT (ready_count <= SELECTOR_MAX_FDS);
+    ASSERT (event_count <= this->max_events);
 
-    struct epoll_event* ptevent = this->epoll_events;
-    SelectionKey** ptready = this->ready;
+    struct epoll_event* ptevent = this->epoll_events.data();
+    SelectionKey** ptready = this->readyBuffer(ready_count + event_count);
 
-    for (int ii=0; ii<ready_count; ii++, ptevent++, ptready++) {
+    for (int ii=0; ii<event_count; ii++, ptevent++) {
         SelectionKey* ptkey = (SelectionKey*) ptevent->data.ptr;
 
+        if (ptkey->edge_triggered) {
+            if (ptevent->events & (EPOLLIN | EPOLLPRI)) {
+                ptkey->edge_ready |= KEY_READ;
+            }
+
+            if (ptevent->events & EPOLLOUT) {
+                ptkey->edge_ready |= KEY_WRITE;
+            }
+
+            if (ptevent->events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                ptkey->edge_ready |= KEY_READ | KEY_WRITE;
+            }
+
+            const int readyops = ptkey->edge_ready & ptkey->getOps() & (KEY_READ | KEY_WRITE);
+            if (readyops == 0) {
+                // remembered for when interest changes
+                continue;
+            }
+
+            // already delivered from edge_pending above
+            const bool listed = ptkey->readyops != 0;
+            ptkey->readyops |= readyops;
+            if (listed) {
+                continue;
+            }
+
+            ptready[ready_count++] = ptkey;
+            this->addEdgePending(ptkey);
+            TRACE("EDGE %s", ptkey->repr().c_str());
+            continue;
+        }
+
         if (ptevent->events & EPOLLIN) {
             ptkey->readyops |= ptkey->getOps() & KEY_READ;
             TRACE("POLLIN %s", ptkey->repr().c_str());
@@ -155,7 +206,7 @@ int EPollSelector::doSelect(int timeout_msecs) {
             TRACE("POLLERR | POLLHUP | POLLNVAL %s", ptkey->repr().c_str());
         }
 
-        *ptready = ptkey;
+        ptready[ready_count++] = ptkey;
     }
 
     return ready_count;
@@ -163,22 +214,42 @@ int EPollSelector::doSelect(int timeout_msecs) {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+void EPollSelector::addEdgePending(SelectionKey* ptkey) {
+    if (!ptkey->edge_pending) {
+        ptkey->edge_pending = true;
+        this->edge_pending.push_back(ptkey);
+    }
+}
+
 void EPollSelector::updateEpollEvent(SelectionKey* ptkey, bool add_flag) {
     // XXX guessing a bit here...
     int events = EPOLLERR | EPOLLHUP | EPOLLRDHUP; // XXX?
-    if (ptkey->getOps() & KEY_READ) {
-        events = EPOLLIN | EPOLLPRI;
-    }
+    if (ptkey->edge_triggered) {
+        events = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLRDHUP | EPOLLET;
 
-    if (ptkey->getOps() & KEY_WRITE) {
-        events |= EPOLLOUT;
+    } else {
+        if (ptkey->getOps() & KEY_READ) {
+            events = EPOLLIN | EPOLLPRI;
+        }
+
+        if (ptkey->getOps() & KEY_WRITE) {
+            events |= EPOLLOUT;
+        }
     }
 
     struct epoll_event event;
     event.events = events;
     event.data.ptr = ptkey;
     int op = add_flag ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    this->ctl_count++;
     int res = epoll_ctl(this->epoll_fd, op, ptkey->fileno(), &event);
+
+    // a canceled key revived for a new socket with a recycled fd (the close removed the old one
+    // from epoll)
+    if (res != 0 && errno == ENOENT && !add_flag) {
+        res = epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, ptkey->fileno(), &event);
+    }
+
     if (res != 0) {
         if (errno == EBADF) {
             K273::l_error("An error occurred during epoll_ctl() : fd is bad %d", ptkey->fileno());
@@ -2,28 +2,56 @@
 #include "kelvin/selector.h"
 
 // std includes
+#include <vector>
+#include <cstdint>
 #include <sys/epoll.h>
 
 namespace Kelvin {
 
     class EPollSelector : public Selector {
       public:
-        EPollSelector();
+        // max_events is how many ready events a single doSelect() can return, independent of the
+        // number of registered keys.
+        //
+        // edge_triggered: keys registered with OP_EDGE are added to epoll once with EPOLLET
+        // for all events, and interest changes are local (no epoll_ctl).  Readiness is
+        // remembered per key, and the key is re-delivered every doSelect() until the handler
+        // calls SelectionKey::drained().
+        EPollSelector(int max_events=1024, bool edge_triggered=false);
         virtual ~EPollSelector();
 
       public:
-        virtual SelectionKey* registerInterests(int fd, int ops, void* ptdata=nullptr);
         virtual int doSelect(int timeout_msecs);
 
       private:
+        virtual void addInterest(SelectionKey* ptkey);
         virtual void updateSelectionKey(SelectionKey* ptkey);
-        virtual void updateSelectionKeys();
         virtual void finalizeInterest(SelectionKey* ptkey);
         void updateEpollEvent(SelectionKey* ptkey, bool add_flag);
+        void addEdgePending(SelectionKey* ptkey);
+
+      public:
+        // stats
+        uint64_t getCtlCount() const {
+            return this->ctl_count;
+        }
+
+        uint64_t getWaitCount() const {
+            return this->wait_count;
+        }
 
       private:
         int epoll_fd;
-        struct epoll_event epoll_events[SELECTOR_MAX_FDS];
+        const int max_events;
+        const bool edge_triggered;
+        std::vector <struct epoll_event> epoll_events;
+
+        // edge triggered keys with readiness not yet drained
+        std::vector <SelectionKey*> edge_pending;
+
+        uint64_t ctl_count;
+        uint64_t wait_count;
     };
 
 }
+
@@ -24,49 +24,16 @@ static const bool _debug_log = false;
 ///////////////////////////////////////////////////////////////////////////////
 
 PollSelector::PollSelector() {
-    ::memset(this->pollfds, 0, sizeof(struct pollfd) * SELECTOR_MAX_FDS);
 }
 
 PollSelector::~PollSelector() {
 }
 
-SelectionKey* PollSelector::registerInterests(int fd, int ops, void* ptdata) {
-    /* will register an interest for a file descriptor */
-
-    TRACE("PollSelector::registerInterests() fd: %d, ops: %d, number_keys: %d", fd, ops, this->number_keys);
-
-    SelectionKey** ptptkey = this->keys;
-    for (int ii=0; ii<this->number_keys; ii++, ptptkey++) {
-        SelectionKey* ptkey = *ptptkey;
-        if (ptkey->fd == fd) {
-
-            // update ops and data
-            if (ops) {
-                ptkey->setOps(ops);
-            } else {
-                ptkey->cancel();
-            }
-
-            ptkey->ptdata= ptdata;
-            return ptkey;
-        }
-    }
-
-    if (this->number_keys == SELECTOR_MAX_FDS) {
-        throw SelectorError("Exceeded number of registrations");
-    }
-
-    SelectionKey* key = new SelectionKey(fd, ops, this, ptdata);
-    struct pollfd* ptpollfd = &this->pollfds[this->number_keys];
-    this->updatePollFd(ptpollfd, key);
-    this->number_keys++;
-    *ptptkey = key;
-
-    TRACE("PollSelector::registerInterests() / new registration key: %s number_keys: %d",
-          key->repr().c_str
-          (), this->number_keys);
-
-    return key;
+void PollSelector::addInterest(SelectionKey* ptkey) {
+    ptkey->index = this->keys.size();
+    this->keys.push_back(ptkey);
+    this->pollfds.emplace_back();
+    this->updatePollFd(&this->pollfds.back(), ptkey);
 }
 
 int PollSelector::doSelect(int timeout_msecs) {
@@ -84,14 +51,14 @@ int PollSelector::doSelect(int timeout_msecs) {
 
     if (_debug_log) {
         TRACE("IN keys: %d", this->number_keys);
-        struct pollfd* p = this->pollfds;
+        struct pollfd* p = this->pollfds.data();
         for (int ii=0; ii<this->number_keys; ii++, p++) {
             TRACE("  fd: %d, events: %d, revents: %d", p->fd, p->events, p->revents);
         }
     }
 
 
-    int ready_count = poll(this->pollfds, this->number_keys, timeout_msecs);
+    int ready_count = poll(this->pollfds.data(), this->number_keys, timeout_msecs);
     if (ready_count < 0)  {
         if (errno == EINTR) {
             // A signal occurred before any requested events
@@ -103,7 +70,7 @@ int PollSelector::doSelect(int timeout_msecs) {
 
     if (_debug_log) {
         TRACE("OUT ready_count: %d ", ready_count);
-        struct pollfd* p = this->pollfds;
+        struct pollfd* p = this->pollfds.data();
         for (int ii=0; ii<this->number_keys; ii++, p++) {
             TRACE("  fd: %d, events: %d, revents: %d", p->fd, p->events, p->revents);
         }
@@ -111,9 +78,8 @@ int PollSelector::doSelect(int timeout_msecs) {
 
     int done = 0;
 
-    struct pollfd* ptpollfd = this->pollfds;
-    SelectionKey** ptready = this->ready;
-
+    struct pollfd* ptpollfd = this->pollfds.data();
+    SelectionKey** ptready = this->readyBuffer(ready_count);
 
     for (int ii=0; ii<this->number_keys; ii++, ptpollfd++) {
         if (done == ready_count) {
@@ -152,29 +118,23 @@ int PollSelector::doSelect(int timeout_msecs) {
 ///////////////////////////////////////////////////////////////////////////////
 
 void PollSelector::updateSelectionKey(SelectionKey* ptkey) {
-    struct pollfd* ptpollfd = this->pollfds;
-    for (int ii=0; ii<this->number_keys; ii++, ptpollfd++) {
-        if (ptkey == this->keys[ii]) {
-            this->updatePollFd(ptpollfd, ptkey);
-            return;
-        }
-    }
-
-    ASSERT_MSG(false, "Should not get here, key does not exist");
-}
-
-void PollSelector::updateSelectionKeys() {
-    struct pollfd* ptpollfd = this->pollfds;
-    for (int ii=0; ii<this->number_keys; ii++, ptpollfd++) {
-        SelectionKey* ptkey = this->keys[ii];
-        this->updatePollFd(ptpollfd, ptkey);
-    }
-
-    TRACE("PollSelector::updateAllInterests() updated interests (number_keys : %d)",
-          this->number_keys);
+    ASSERT_MSG(this->keys[ptkey->index] == ptkey, "Should not get here, key does not exist");
+    this->updatePollFd(&this->pollfds[ptkey->index], ptkey);
 }
 
 void PollSelector::finalizeInterest(SelectionKey* ptkey) {
+    // swap with last, and pop
+    const int index = ptkey->index;
+    ASSERT (this->keys[index] == ptkey);
+
+    SelectionKey* last = this->keys.back();
+    this->keys[index] = last;
+    this->pollfds[index] = this->pollfds.back();
+    last->index = index;
+
+    this->keys.pop_back();
+    this->pollfds.pop_back();
+    ptkey->index = -1;
 }
 
 void PollSelector::updatePollFd(struct pollfd* ptpollfd, SelectionKey* ptkey) {
@@ -2,6 +2,7 @@
 #include "kelvin/selector.h"
 
 // std includes
+#include <vector>
 #include <poll.h>
 
 namespace Kelvin {
@@ -12,18 +13,19 @@ namespace Kelvin {
         virtual ~PollSelector();
 
       public:
-        virtual SelectionKey* registerInterests(int fd, int ops, void* ptdata=nullptr);
         virtual int doSelect(int timeout_msecs);
 
       private:
+        virtual void addInterest(SelectionKey* ptkey);
         virtual void updateSelectionKey(SelectionKey* ptkey);
-        virtual void updateSelectionKeys();
         virtual void finalizeInterest(SelectionKey* ptkey);
 
         void updatePollFd(struct pollfd* ptpollfd, SelectionKey* ptkey);
 
       private:
-        struct pollfd pollfds[SELECTOR_MAX_FDS];
+        // dense, keys[ii] is polled by pollfds[ii] (and SelectionKey::index == ii)
+        std::vector <SelectionKey*> keys;
+        std::vector <struct pollfd> pollfds;
     };
 
 }
@@ -0,0 +1,486 @@
+// local includes
+#include "kelvin/selector.h"
+#include "kelvin/selector_uring.h"
+
+// k273 includes
+#include <k273/logging.h>
+#include <k273/strutils.h>
+
+// std includes
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+///////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const bool _debug_log = false;
+#define TRACE(fmt, args...) if (_debug_log) { K273::l_debug(fmt, ## args); }
+
+///////////////////////////////////////////////////////////////////////////////
+// user_data encoding.  Low 2 bits are the tag.
+//
+//   0                               : internal (timeouts, removes, cancels) - ignored
+//   generation << 32 | fd << 2 | 1  : poll for a key
+//   UringCompletion* | 2            : completion mode
+
+static const uint64_t TAG_MASK = 3;
+static const uint64_t TAG_POLL = 1;
+static const uint64_t TAG_COMPLETION = 2;
+
+static inline uint64_t pollUserData(int fd, uint32_t generation) {
+    return ((uint64_t) generation << 32) | ((uint64_t) fd << 2) | TAG_POLL;
+}
+
+static inline uint64_t completionUserData(UringCompletion* completion) {
+    return reinterpret_cast <uint64_t> (completion) | TAG_COMPLETION;
+}
+
+static int uringSetup(unsigned int entries, struct io_uring_params* params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+UringCompletion::~UringCompletion() {
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+UringSelector::UringSelector(unsigned int entries) :
+    ring_fd(-1),
+    sq_ring(MAP_FAILED),
+    sq_ring_size(0),
+    cq_ring(MAP_FAILED),
+    cq_ring_size(0),
+    sqes((struct io_uring_sqe*) MAP_FAILED),
+    sqes_size(0),
+    to_submit(0),
+    next_generation(1),
+    inflight_count(0),
+    enter_count(0) {
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    this->ring_fd = uringSetup(entries, &params);
+    if (this->ring_fd < 0) {
+        throw SelectorError(K273::fmtString("io_uring_setup() failed: %s", strerror(errno)));
+    }
+
+    // we rely on the kernel buffering overflowed completions (5.5+)
+    if ((params.features & IORING_FEAT_NODROP) == 0) {
+        close(this->ring_fd);
+        throw SelectorError("io_uring too old (no IORING_FEAT_NODROP)");
+    }
+
+    this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    this->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        this->sq_ring_size = std::max(this->sq_ring_size, this->cq_ring_size);
+        this->cq_ring_size = this->sq_ring_size;
+    }
+
+    this->sq_ring = mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQ_RING);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        this->cq_ring = this->sq_ring;
+    } else if (this->sq_ring != MAP_FAILED) {
+        this->cq_ring = mmap(nullptr, this->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_CQ_RING);
+    }
+
+    this->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (this->cq_ring != MAP_FAILED) {
+        this->sqes = (struct io_uring_sqe*) mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES);
+    }
+
+    if (this->sqes == MAP_FAILED) {
+        int err = errno;
+        this->cleanup();
+        throw SelectorError(K273::fmtString("mmap() of io_uring failed: %s", strerror(err)));
+    }
+
+    char* sq_base = (char*) this->sq_ring;
+    this->sq_head = (unsigned int*) (sq_base + params.sq_off.head);
+    this->sq_tail = (unsigned int*) (sq_base + params.sq_off.tail);
+    this->sq_array = (unsigned int*) (sq_base + params.sq_off.array);
+    this->sq_mask = *(unsigned int*) (sq_base + params.sq_off.ring_mask);
+    this->sq_entries = params.sq_entries;
+
+    char* cq_base = (char*) this->cq_ring;
+    this->cq_head = (unsigned int*) (cq_base + params.cq_off.head);
+    this->cq_tail = (unsigned int*) (cq_base + params.cq_off.tail);
+    this->cqes = (struct io_uring_cqe*) (cq_base + params.cq_off.cqes);
+    this->cq_mask = *(unsigned int*) (cq_base + params.cq_off.ring_mask);
+
+    // sqe index ii always lives in slot ii, so the array is fixed up front
+    for (unsigned int ii=0; ii<this->sq_entries; ii++) {
+        this->sq_array[ii] = ii;
+    }
+
+    this->readyBuffer(64);
+
+    K273::l_debug("UringSelector created with %u sq entries, %u cq entries",
+                  params.sq_entries, params.cq_entries);
+}
+
+UringSelector::~UringSelector() {
+    this->cleanup();
+}
+
+void UringSelector::cleanup() {
+    if (this->sqes != MAP_FAILED) {
+        munmap(this->sqes, this->sqes_size);
+        this->sqes = (struct io_uring_sqe*) MAP_FAILED;
+    }
+
+    if (this->cq_ring != MAP_FAILED && this->cq_ring != this->sq_ring) {
+        munmap(this->cq_ring, this->cq_ring_size);
+    }
+
+    this->cq_ring = MAP_FAILED;
+
+    if (this->sq_ring != MAP_FAILED) {
+        munmap(this->sq_ring, this->sq_ring_size);
+        this->sq_ring = MAP_FAILED;
+    }
+
+    if (this->ring_fd >= 0) {
+        close(this->ring_fd);
+        this->ring_fd = -1;
+    }
+}
+
+bool UringSelector::available() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = uringSetup(2, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    close(fd);
+    return (params.features & IORING_FEAT_NODROP) != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool UringSelector::sqFull() const {
+    return *this->sq_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) >= this->sq_entries;
+}
+
+struct io_uring_sqe* UringSelector::getSqe() {
+    /* Full - submit what we have without waiting.  The kernel may not take any (EBUSY, its
+       completion backlog can't be flushed into a full completion queue; EAGAIN, out of
+       memory), so make room in the completion queue and try again. */
+
+    for (int attempt=0; this->sqFull(); attempt++) {
+        if (attempt == 1000) {
+            throw K273::Exception("UringSelector: submission queue stuck full");
+        }
+
+        this->enter(this->to_submit, 0, 0);
+        if (!this->sqFull()) {
+            break;
+        }
+
+        if (this->setAsideCompletions() == 0) {
+            sched_yield();
+        }
+    }
+
+    const unsigned int tail = *this->sq_tail;
+    struct io_uring_sqe* sqe = &this->sqes[tail & this->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    // published on enter()
+    __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    this->to_submit++;
+
+    return sqe;
+}
+
+int UringSelector::enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    this->enter_count++;
+    int res = (int) syscall(__NR_io_uring_enter, this->ring_fd, to_submit, min_complete, flags, nullptr, 0);
+    int err = errno;
+
+    // whatever the kernel consumed is submitted, regardless of errors
+    this->to_submit = *this->sq_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+
+    if (res < 0) {
+        // interrupted, or completion backlog - both are fine, caller reaps what is there
+        if (err == EINTR || err == EBUSY || err == EAGAIN) {
+            return 0;
+        }
+
+        throw K273::SysException("An error occurred during io_uring_enter()", err);
+    }
+
+    return res;
+}
+
+int UringSelector::setAsideCompletions() {
+    unsigned int head = *this->cq_head;
+    const unsigned int tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+
+    const int count = tail - head;
+    while (head != tail) {
+        const struct io_uring_cqe* cqe = &this->cqes[head & this->cq_mask];
+        this->set_aside.push_back(SetAside{cqe->user_data, cqe->res});
+        head++;
+    }
+
+    __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+
+    TRACE("UringSelector::setAsideCompletions() %d", count);
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void UringSelector::addInterest(SelectionKey* ptkey) {
+    const int fd = ptkey->fileno();
+    ASSERT (fd < (1 << 30));
+
+    if (fd >= (int) this->armed.size()) {
+        this->armed.resize(this->fd_keys.size(), 0);
+    }
+
+    this->armed[fd] = 0;
+    this->rearm.push_back(fd);
+}
+
+void UringSelector::updateSelectionKey(SelectionKey* ptkey) {
+    // rearm with the new mask on the next doSelect()
+    this->disarmPoll(ptkey->fileno());
+    this->rearm.push_back(ptkey->fileno());
+}
+
+void UringSelector::finalizeInterest(SelectionKey* ptkey) {
+    TRACE("UringSelector::finalizeInterest() fd: %d", ptkey->fileno());
+
+    // note closing the fd does not remove an io_uring poll (it holds a reference to the file)
+    this->disarmPoll(ptkey->fileno());
+}
+
+void UringSelector::armPoll(SelectionKey* ptkey) {
+    const int fd = ptkey->fileno();
+
+    uint32_t events = 0;
+    if (ptkey->getOps() & KEY_READ) {
+        events |= POLLIN | POLLPRI;
+    }
+
+    if (ptkey->getOps() & KEY_WRITE) {
+        events |= POLLOUT;
+    }
+
+    uint32_t generation = this->next_generation++;
+    if (unlikely(generation == 0)) {
+        generation = this->next_generation++;
+    }
+
+    struct io_uring_sqe* sqe = this->getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = pollUserData(fd, generation);
+
+    this->armed[fd] = generation;
+}
+
+void UringSelector::disarmPoll(int fd) {
+    if (fd >= (int) this->armed.size() || this->armed[fd] == 0) {
+        return;
+    }
+
+    struct io_uring_sqe* sqe = this->getSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = pollUserData(fd, this->armed[fd]);
+    sqe->user_data = 0;
+
+    this->armed[fd] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void UringSelector::submitRead(int fd, char* buf, int size, UringCompletion* completion) {
+    ASSERT ((reinterpret_cast <uint64_t> (completion) & TAG_MASK) == 0);
+
+    struct io_uring_sqe* sqe = this->getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast <uint64_t> (buf);
+    sqe->len = size;
+    sqe->user_data = completionUserData(completion);
+
+    this->inflight_count++;
+}
+
+void UringSelector::submitWrite(int fd, const char* buf, int size, UringCompletion* completion) {
+    ASSERT ((reinterpret_cast <uint64_t> (completion) & TAG_MASK) == 0);
+
+    struct io_uring_sqe* sqe = this->getSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast <uint64_t> (buf);
+    sqe->len = size;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = completionUserData(completion);
+
+    this->inflight_count++;
+}
+
+void UringSelector::cancelCompletion(UringCompletion* completion) {
+    struct io_uring_sqe* sqe = this->getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = completionUserData(completion);
+    sqe->user_data = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+int UringSelector::doSelect(int timeout_msecs) {
+    TRACE("UringSelector::doSelect() timeout_msecs %d, cancel: %d, nfds: %d, to_submit: %u",
+          timeout_msecs, this->canceled_count, this->number_keys, this->to_submit);
+
+    if (this->canceled_count) {
+        this->removeCanceled();
+    }
+
+    // (re)arm keys that fired last time, or have changed interest
+    for (int fd : this->rearm) {
+        SelectionKey* ptkey = this->lookupKey(fd);
+        if (ptkey != nullptr && ptkey->getOps() != 0 && this->armed[fd] == 0) {
+            this->armPoll(ptkey);
+        }
+    }
+
+    this->rearm.clear();
+
+    // only wait if there is nothing already sitting in the completion queue (or set aside)
+    bool wait = (timeout_msecs != 0 && this->set_aside.empty() &&
+                 *this->cq_head == __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE));
+
+    if (wait && timeout_msecs > 0) {
+        // times out, or completes as soon as one other completion is posted
+        this->timeout_ts.tv_sec = timeout_msecs / 1000;
+        this->timeout_ts.tv_nsec = (timeout_msecs % 1000) * 1000000L;
+
+        struct io_uring_sqe* sqe = this->getSqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast <uint64_t> (&this->timeout_ts);
+        sqe->len = 1;
+        sqe->off = 1;
+        sqe->user_data = 0;
+    }
+
+    // submit everything batched up since the last call, and wait - in one syscall
+    if (wait) {
+        this->enter(this->to_submit, 1, IORING_ENTER_GETEVENTS);
+    } else if (this->to_submit > 0) {
+        this->enter(this->to_submit, 0, 0);
+    }
+
+    // reap, oldest first
+    int ready_count = 0;
+    for (size_t ii=0; ii<this->set_aside.size(); ii++) {
+        this->handleCompletion(this->set_aside[ii].user_data, this->set_aside[ii].res, ready_count);
+    }
+
+    this->set_aside.clear();
+
+    unsigned int head = *this->cq_head;
+    unsigned int tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe* cqe = &this->cqes[head & this->cq_mask];
+        const uint64_t user_data = cqe->user_data;
+        const int res = cqe->res;
+
+        head++;
+        __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+
+        this->handleCompletion(user_data, res, ready_count);
+
+        // completions may have posted more (or set some aside, moving the head)
+        head = *this->cq_head;
+        if (head == tail) {
+            tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    // and anything a completion callback's submits set aside
+    for (size_t ii=0; ii<this->set_aside.size(); ii++) {
+        this->handleCompletion(this->set_aside[ii].user_data, this->set_aside[ii].res, ready_count);
+    }
+
+    this->set_aside.clear();
+
+    TRACE("UringSelector::doSelect() ready_count: %d ", ready_count);
+    return ready_count;
+}
+
+void UringSelector::handleCompletion(uint64_t user_data, int res, int& ready_count) {
+    if (user_data == 0) {
+        // internal
+
+    } else if ((user_data & TAG_MASK) == TAG_POLL) {
+        const int fd = (int) ((user_data & 0xffffffff) >> 2);
+        const uint32_t generation = (uint32_t) (user_data >> 32);
+
+        SelectionKey* ptkey = this->lookupKey(fd);
+        if (ptkey == nullptr || this->armed[fd] != generation) {
+            TRACE("stale poll completion fd: %d, res: %d", fd, res);
+
+        } else {
+            // one shot, no longer armed.  Rearmed on the next doSelect() (after handlers
+            // have had a chance to change interests).
+            this->armed[fd] = 0;
+            this->rearm.push_back(fd);
+
+            const int events = res < 0 ? POLLERR : res;
+
+            if (events & (POLLIN | POLLPRI)) {
+                ptkey->readyops |= ptkey->getOps() & KEY_READ;
+            }
+
+            if (events & POLLOUT) {
+                ptkey->readyops |= ptkey->getOps() & KEY_WRITE;
+            }
+
+            if (events & (POLLERR | POLLHUP | POLLNVAL)) {
+                ptkey->readyops |= ptkey->getOps() & (KEY_READ | KEY_WRITE);
+            }
+
+            this->readyBuffer(ready_count + 1)[ready_count] = ptkey;
+            ready_count++;
+            TRACE("ready %s", ptkey->repr().c_str());
+        }
+
+    } else {
+        ASSERT ((user_data & TAG_MASK) == TAG_COMPLETION);
+        this->inflight_count--;
+
+        UringCompletion* completion = reinterpret_cast <UringCompletion*> (user_data & ~TAG_MASK);
+        completion->onComplete(res);
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+// local includes
+#include "kelvin/selector.h"
+#include "kelvin/bytebuffer.h"
+
+// std includes
+#include <vector>
+#include <cstdint>
+#include <linux/time_types.h>
+
+///////////////////////////////////////////////////////////////////////////////
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace Kelvin {
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Completion mode callback.  result is bytes transferred, or -errno (-ECANCELED if canceled
+    // via UringSelector::cancelCompletion()).  Called from within doSelect().
+
+    class UringCompletion {
+    public:
+        virtual ~UringCompletion();
+
+    public:
+        virtual void onComplete(int result) = 0;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    // io_uring via the raw syscalls (no liburing).
+    //
+    // Poll mode is a drop in for PollSelector/EPollSelector: each key has a one shot poll
+    // armed.  Arming, re-arming, and changes of interest are queued as sqes and submitted along
+    // with the wait in the single io_uring_enter() call in doSelect().
+    //
+    // Completion mode: submitRead()/submitWrite() recv/send directly into/from caller memory,
+    // and the UringCompletion is called back from doSelect().  These are batched in the same
+    // way.  The memory (and the completion) must remain valid until onComplete() is called.
+    //
+    // The constructor throws SelectorError if io_uring is not available (old kernel, seccomp,
+    // kernel.io_uring_disabled).  See Selector::create() for fallback.
+
+    class UringSelector : public Selector {
+      public:
+        UringSelector(unsigned int entries=4096);
+        virtual ~UringSelector();
+
+      public:
+        virtual int doSelect(int timeout_msecs);
+
+        // cheap probe, creates and destroys a tiny ring
+        static bool available();
+
+        // completion mode
+        void submitRead(int fd, char* buf, int size, UringCompletion* completion);
+        void submitWrite(int fd, const char* buf, int size, UringCompletion* completion);
+
+        // reads into buf's remaining space.  On completion, the caller does buf.skip(result).
+        void submitRead(int fd, ByteBuffer& buf, UringCompletion* completion) {
+            this->submitRead(fd, buf.getInternalBuf(), buf.remaining(), completion);
+        }
+
+        // writes buf's remaining data.  On completion, the caller does buf.skip(result).
+        void submitWrite(int fd, ByteBuffer& buf, UringCompletion* completion) {
+            this->submitWrite(fd, buf.getInternalBuf(), buf.remaining(), completion);
+        }
+
+        void cancelCompletion(UringCompletion* completion);
+
+        // stats
+        uint64_t getEnterCount() const {
+            return this->enter_count;
+        }
+
+        int getInflightCount() const {
+            return this->inflight_count;
+        }
+
+      private:
+        virtual void addInterest(SelectionKey* ptkey);
+        virtual void updateSelectionKey(SelectionKey* ptkey);
+        virtual void finalizeInterest(SelectionKey* ptkey);
+
+        void cleanup();
+
+        void armPoll(SelectionKey* ptkey);
+        void disarmPoll(int fd);
+
+        struct io_uring_sqe* getSqe();
+        bool sqFull() const;
+        int enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags);
+
+        // moves the completion queue to set_aside, returns the number moved
+        int setAsideCompletions();
+        void handleCompletion(uint64_t user_data, int res, int& ready_count);
+
+      private:
+        int ring_fd;
+
+        // mmaped rings
+        void* sq_ring;
+        size_t sq_ring_size;
+        void* cq_ring;
+        size_t cq_ring_size;
+        struct io_uring_sqe* sqes;
+        size_t sqes_size;
+
+        unsigned int* sq_head;
+        unsigned int* sq_tail;
+        unsigned int* sq_array;
+        unsigned int sq_mask;
+        unsigned int sq_entries;
+
+        unsigned int* cq_head;
+        unsigned int* cq_tail;
+        struct io_uring_cqe* cqes;
+        unsigned int cq_mask;
+
+        // queued sqes, not yet submitted
+        unsigned int to_submit;
+
+        // completions taken off the queue by getSqe() (to make room), handled by the next
+        // doSelect()
+        struct SetAside {
+            uint64_t user_data;
+            int res;
+        };
+
+        std::vector <SetAside> set_aside;
+
+        // indexed by fd.  Generation of the armed poll, 0 if not armed.  Completions for
+        // anything else are stale (disarmed, or fd recycled) and dropped.
+        std::vector <uint32_t> armed;
+        uint32_t next_generation;
+
+        // fds to (re)arm at the start of the next doSelect()
+        std::vector <int> rearm;
+
+        // must stay valid until submitted
+        struct __kernel_timespec timeout_ts;
+
+        int inflight_count;
+        uint64_t enter_count;
+    };
+
+}
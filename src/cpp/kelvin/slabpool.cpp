@@ -0,0 +1,51 @@
+// local includes
+#include "kelvin/slabpool.h"
+
+// k273 includes
+#include <k273/exception.h>
+
+///////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+SlabPool::SlabPool(int slab_size, int max_free) :
+    slab_size(slab_size),
+    max_free(max_free),
+    free_list(nullptr),
+    free_count(0) {
+    ASSERT (slab_size >= (int) sizeof(FreeSlab));
+}
+
+SlabPool::~SlabPool() {
+    while (this->free_list != nullptr) {
+        FreeSlab* slab = this->free_list;
+        this->free_list = slab->next;
+        delete[] reinterpret_cast <char*> (slab);
+    }
+}
+
+char* SlabPool::acquire() {
+    FreeSlab* slab = this->free_list;
+    if (slab != nullptr) {
+        this->free_list = slab->next;
+        this->free_count--;
+        return reinterpret_cast <char*> (slab);
+    }
+
+    return new char[this->slab_size];
+}
+
+void SlabPool::release(char* memory) {
+    if (this->free_count >= this->max_free) {
+        delete[] memory;
+        return;
+    }
+
+    FreeSlab* slab = reinterpret_cast <FreeSlab*> (memory);
+    slab->next = this->free_list;
+    this->free_list = slab;
+    this->free_count++;
+}
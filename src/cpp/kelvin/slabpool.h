@@ -0,0 +1,47 @@
+#pragma once
+
+namespace Kelvin {
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Free list of fixed size slabs of memory (ie for connection input buffers, borrowed only
+    /// while there is data in them).  Not thread safe - one per Scheduler (see
+    /// Scheduler::getInputPool()).  Keeps at most max_free slabs around, the rest go back to the
+    /// heap.
+
+    class SlabPool {
+    public:
+        SlabPool(int slab_size, int max_free=64);
+        ~SlabPool();
+
+        SlabPool(const SlabPool&) = delete;
+        SlabPool& operator=(const SlabPool&) = delete;
+
+    public:
+        char* acquire();
+        void release(char* slab);
+
+        int getSlabSize() const {
+            return this->slab_size;
+        }
+
+        int getFreeCount() const {
+            return this->free_count;
+        }
+
+        static constexpr int DEFAULT_SLAB_SIZE = 128 * 1024;
+
+    private:
+        // free slabs are linked through their first bytes
+        struct FreeSlab {
+            FreeSlab* next;
+        };
+
+        const int slab_size;
+        const int max_free;
+
+        FreeSlab* free_list;
+        int free_count;
+    };
+
+}
@@ -9,6 +9,7 @@
 // std includes
 #include <cerrno>
 #include <cstring>
+#include <algorithm>
 #include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -18,9 +19,11 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <net/if_arp.h>
+#include <linux/errqueue.h>
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -129,6 +132,14 @@ void Socket::shutdown(bool throws) {
     }
 }
 
+void Socket::closeReset() {
+    struct linger lg;
+    lg.l_onoff = 1;
+    lg.l_linger = 0;
+    setsockopt(this->sockfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    ::close(this->sockfd);
+}
+
 void Socket::setBlocking(bool block) {
     K273::l_verbose("setting O_NONBLOCK(%s) on %d", block ? "false" : "true", this->sockfd);
     int delay_flag = fcntl(this->sockfd, F_GETFL, 0);
@@ -228,36 +239,59 @@ string UnconnectedSocket::getWhoFrom() {
 ConnectedSocket::ConnectedSocket(int fd) :
     Socket(fd),
     default_send_flags(0),
+    buffer_count(0),
+    buffer_size(0),
     mmheaders(),
     iov(),
     recvmmsg_buffer(),
-    recvmmsg_results() {
+    recvmmsg_control(),
+    recv_control(false),
+    gro_enabled(false),
+    timestamps_enabled(false),
+    truncated_count(0),
+    recvmmsg_results(),
+    recvmmsg_timestamps() {
 
     K273::l_debug("creating ConnectedSocket with fd %d", fd);
 }
 
-void ConnectedSocket::enableRecvMultiple() {
+void ConnectedSocket::enableRecvMultiple(int buffer_count, int buffer_size) {
 
     // Ensure we didn't do this already
     ASSERT(!this->recvmmsg_buffer);
+    ASSERT(buffer_count > 0 && buffer_size > 0);
+
+    // smaller buffers would truncate coalesced datagrams
+    if (this->gro_enabled && buffer_size < MaxGROSize) {
+        K273::l_debug("GRO enabled, raising recvMultiple buffer size %d -> %d (fd=%d)",
+                      buffer_size, MaxGROSize, this->sockfd);
+        buffer_size = MaxGROSize;
+    }
+
+    this->buffer_count = buffer_count;
+    this->buffer_size = buffer_size;
 
     // Allocate the buffer to store the recvmmsg results
-    this->recvmmsg_buffer = std::unique_ptr<char[]>(new char[MaxBufferCount*MaxBufferSize]);
+    this->recvmmsg_buffer = std::unique_ptr<char[]>(new char[(size_t) buffer_count * buffer_size]);
+    this->recvmmsg_control = std::unique_ptr<char[]>(new char[(size_t) buffer_count * ControlSize]);
+
+    this->mmheaders.resize(buffer_count);
+    this->iov.resize(buffer_count);
 
     // Initialize mmheaders for use with recvMultiple
-    for (int ii=0; ii<MaxBufferCount; ii++) {
+    for (int ii=0; ii<buffer_count; ii++) {
 
         // Initialize the iovecs with the buffers
         // All the buffers are in a continguous piece of memory so do pointer
         // arithmetic to get the correct buffer
-        this->iov[ii].iov_base = this->recvmmsg_buffer.get() + MaxBufferSize * ii;
-        this->iov[ii].iov_len = MaxBufferSize;
+        this->iov[ii].iov_base = this->recvmmsg_buffer.get() + (size_t) buffer_size * ii;
+        this->iov[ii].iov_len = buffer_size;
 
         this->mmheaders[ii].msg_hdr.msg_name = nullptr;
         this->mmheaders[ii].msg_hdr.msg_namelen = 0;
 
         // Give it the corresponding iov
-        this->mmheaders[ii].msg_hdr.msg_iov = this->iov + ii;
+        this->mmheaders[ii].msg_hdr.msg_iov = &this->iov[ii];
         this->mmheaders[ii].msg_hdr.msg_iovlen = 1;
 
         this->mmheaders[ii].msg_hdr.msg_control = nullptr;
@@ -265,8 +299,45 @@ void ConnectedSocket::enableRecvMultiple() {
         this->mmheaders[ii].msg_hdr.msg_flags = 0;
     }
 
-    // Pre-allocalte MaxBufferCount items
-    this->recvmmsg_results.reserve(MaxBufferCount);
+    // Pre-allocalte buffer_count items
+    this->recvmmsg_results.reserve(buffer_count);
+    this->recvmmsg_timestamps.reserve(buffer_count);
+}
+
+bool ConnectedSocket::enableGRO() {
+    ASSERT_MSG(!this->recvmmsg_buffer || this->buffer_size >= MaxGROSize,
+               "enableGRO() must be called before enableRecvMultiple()");
+
+    int on = 1;
+    if (setsockopt(this->sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) != 0) {
+        K273::l_warning("UDP_GRO not supported (fd=%d): %s", this->sockfd, strerror(errno));
+        return false;
+    }
+
+    this->gro_enabled = true;
+    this->recv_control = true;
+    return true;
+}
+
+bool ConnectedSocket::enableRecvTimestamps() {
+    int on = 1;
+    if (setsockopt(this->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0) {
+        K273::l_warning("SO_TIMESTAMPNS not supported (fd=%d): %s", this->sockfd, strerror(errno));
+        return false;
+    }
+
+    this->timestamps_enabled = true;
+    this->recv_control = true;
+    return true;
+}
+
+bool ConnectedSocket::setSendSegmentSize(int segment_size) {
+    if (setsockopt(this->sockfd, SOL_UDP, UDP_SEGMENT, &segment_size, sizeof(segment_size)) != 0) {
+        K273::l_warning("UDP_SEGMENT not supported (fd=%d): %s", this->sockfd, strerror(errno));
+        return false;
+    }
+
+    return true;
 }
 
 int ConnectedSocket::send(const char *buf, int size, int flags) {
@@ -283,6 +354,119 @@ int ConnectedSocket::send(const char *buf, int size, int flags) {
     return bytes;
 }
 
+int ConnectedSocket::sendMultiple(const struct iovec* messages, int count, int flags) {
+    if ((int) this->send_headers.size() < count) {
+        this->send_headers.resize(count);
+    }
+
+    for (int ii=0; ii<count; ii++) {
+        struct msghdr& hdr = this->send_headers[ii].msg_hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = const_cast <struct iovec*> (messages + ii);
+        hdr.msg_iovlen = 1;
+    }
+
+    int send_flags = this->default_send_flags | flags;
+    int sent = ::sendmmsg(this->sockfd, this->send_headers.data(), count, send_flags);
+    if (sent < 0) {
+        if (errno == EAGAIN) {
+            return -1;
+        }
+
+        throw SocketError("in sendMultiple");
+    }
+
+    return sent;
+}
+
+int ConnectedSocket::sendGather(const struct iovec* msg_iov, int msg_iovlen, int flags) {
+    struct msghdr hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = const_cast <struct iovec*> (msg_iov);
+    hdr.msg_iovlen = msg_iovlen;
+
+    int send_flags = this->default_send_flags | flags;
+    int bytes = ::sendmsg(this->sockfd, &hdr, send_flags);
+    if (bytes < 0) {
+        if (errno == EAGAIN) {
+            return -1;
+        }
+
+        throw SocketError("in sendGather");
+    }
+
+    return bytes;
+}
+
+bool ConnectedSocket::enableZeroCopy() {
+    int on = 1;
+    if (setsockopt(this->sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) {
+        K273::l_warning("SO_ZEROCOPY not supported (fd=%d): %s", this->sockfd, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+int ConnectedSocket::sendZeroCopy(const char* buf, int size, int flags) {
+    int send_flags = this->default_send_flags | flags | MSG_ZEROCOPY;
+    int bytes = ::send(this->sockfd, buf, size, send_flags);
+    if (bytes < 0) {
+        if (errno == EAGAIN) {
+            return -1;
+        }
+
+        if (errno == ENOBUFS) {
+            return ZEROCOPY_NOBUFS;
+        }
+
+        throw SocketError("in sendZeroCopy");
+    }
+
+    return bytes;
+}
+
+int ConnectedSocket::readZeroCopyCompletions(ZeroCopyRange* ranges, int max_ranges) {
+    int count = 0;
+    while (count < max_ranges) {
+        char control[128];
+        struct msghdr hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+
+        if (::recvmsg(this->sockfd, &hdr, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN) {
+                break;
+            }
+
+            throw SocketError("in readZeroCopyCompletions");
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+
+            const bool ip_error = ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                                   (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR));
+            if (!ip_error) {
+                continue;
+            }
+
+            const struct sock_extended_err* err = (const struct sock_extended_err*) CMSG_DATA(cmsg);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            ranges[count].lo = err->ee_info;
+            ranges[count].hi = err->ee_data;
+            ranges[count].copied = (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+            count++;
+        }
+    }
+
+    return count;
+}
+
 int ConnectedSocket::recv(char *buf, int size, int flags) {
     int bytes = ::recv(this->sockfd, buf, size, flags);
     if (bytes < 0) {
@@ -318,11 +502,21 @@ const std::vector<iovec>& ConnectedSocket::recvMultiple(int flags) {
     // Test that we have the buffers
     ASSERT(this->recvmmsg_buffer);
 
+    // The kernel overwrites the control lengths
+    if (this->recv_control) {
+        for (int ii=0; ii<this->buffer_count; ii++) {
+            msghdr& hdr = this->mmheaders[ii].msg_hdr;
+            hdr.msg_control = this->recvmmsg_control.get() + ControlSize * ii;
+            hdr.msg_controllen = ControlSize;
+        }
+    }
+
     // Make the system call to recvmmsg
-    int count = ::recvmmsg(this->sockfd, this->mmheaders, MaxBufferCount, flags, nullptr);
+    int count = ::recvmmsg(this->sockfd, this->mmheaders.data(), this->buffer_count, flags, nullptr);
 
     // Erase any counts from previous calls
     this->recvmmsg_results.clear();
+    this->recvmmsg_timestamps.clear();
 
     // Check to see if we were given any messages
     if (count == -1) {
@@ -341,9 +535,50 @@ const std::vector<iovec>& ConnectedSocket::recvMultiple(int flags) {
 
         // All the buffers are in a continguous piece of memory so do pointer
         // arithmetic to get the correct buffer
-        this->recvmmsg_results.push_back(
-                        iovec{this->recvmmsg_buffer.get() + MaxBufferSize*i,
-                              this->mmheaders[i].msg_len});
+        char* buf = this->recvmmsg_buffer.get() + (size_t) this->buffer_size * i;
+        const unsigned int len = this->mmheaders[i].msg_len;
+
+        // The datagram was cut short, or the GRO segment size may be missing.  Either way the
+        // data can't be handed on as is.
+        const int msg_flags = this->mmheaders[i].msg_hdr.msg_flags;
+        if (msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+            this->truncated_count++;
+            K273::l_warning("recvmmsg dropping truncated message (fd=%d, len=%u, flags=%s%s)",
+                            this->sockfd, len,
+                            (msg_flags & MSG_TRUNC) ? "MSG_TRUNC " : "",
+                            (msg_flags & MSG_CTRUNC) ? "MSG_CTRUNC" : "");
+            continue;
+        }
+
+        // GRO coalesced datagrams of segment_size each (the last may be short)
+        int segment_size = 0;
+        timespec stamp = {0, 0};
+        if (this->recv_control) {
+            msghdr* hdr = &this->mmheaders[i].msg_hdr;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    std::memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(int));
+
+                } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                    std::memcpy(&stamp, CMSG_DATA(cmsg), sizeof(timespec));
+                }
+            }
+        }
+
+        if (segment_size <= 0 || (unsigned int) segment_size >= len) {
+            this->recvmmsg_results.push_back(iovec{buf, len});
+
+        } else {
+            for (unsigned int offset = 0; offset < len; offset += segment_size) {
+                this->recvmmsg_results.push_back(
+                    iovec{buf + offset, std::min(len - offset, (unsigned int) segment_size)});
+            }
+        }
+
+        // coalesced datagrams share the timestamp of the first
+        if (this->timestamps_enabled) {
+            this->recvmmsg_timestamps.resize(this->recvmmsg_results.size(), stamp);
+        }
     }
 
     return this->recvmmsg_results;
@@ -450,16 +685,40 @@ void AcceptingSocket::listen(int backlog) {
     this->listening = true;
 }
 
-ConnectedSocket *AcceptingSocket::accept() {
+ConnectedSocket *AcceptingSocket::accept(bool* out_of_fds) {
     ASSERT (this->listening);
 
-    socklen_t addrlen = this->getAddrSize();
-    int res_fd = ::accept(this->sockfd, this->getAddr(), &addrlen);
-    if (res_fd == -1) {
+    if (out_of_fds != nullptr) {
+        *out_of_fds = false;
+    }
+
+    int res_fd = -1;
+    while (true) {
+        socklen_t addrlen = this->getAddrSize();
+        res_fd = ::accept4(this->sockfd, this->getAddr(), &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (res_fd != -1) {
+            break;
+        }
+
+        // the peer gave up while in the backlog, try the next
+        if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        }
+
         if (errno == EAGAIN) {
             return nullptr;
         }
 
+        // out of fds: leave the rest in the backlog rather than die.  Not the same as EAGAIN,
+        // the caller must back off (and is left to log).
+        if (errno == EMFILE || errno == ENFILE) {
+            if (out_of_fds != nullptr) {
+                *out_of_fds = true;
+            }
+
+            return nullptr;
+        }
+
         throw SocketError("AcceptingSocket::accept()");
     }
 
@@ -480,7 +739,7 @@ ConnectedSocket *AcceptingSocket::createSocket(int fd) {
 
 ///////////////////////////////////////////////////////////////////////////////
 
-TcpAcceptingSocket::TcpAcceptingSocket(const string& ipaddr, int port) :
+TcpAcceptingSocket::TcpAcceptingSocket(const string& ipaddr, int port, bool reuse_port) :
     AcceptingSocket(inetSocket()) {
 
     this->addr = inetAddress(ipaddr, port);
@@ -491,6 +750,12 @@ TcpAcceptingSocket::TcpAcceptingSocket(const string& ipaddr, int port) :
         throw SocketError("TCP socket TIME_WAIT.");
     }
 
+    if (reuse_port) {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+            throw SocketError("TCP socket SO_REUSEPORT.");
+        }
+    }
+
     if (bind(sockfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_in)) == -1) {
         throw SocketError("Bind on socket.");
     }
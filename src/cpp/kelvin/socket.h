@@ -8,6 +8,8 @@
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <vector>
+#include <memory>
+#include <ctime>
 
 namespace Kelvin {
 
@@ -30,6 +32,9 @@ namespace Kelvin {
         void close(bool throws=true);
         void shutdown(bool throws=true);
 
+        // close with a RST rather than a FIN (SO_LINGER 0), so nothing is left in TIME_WAIT
+        void closeReset();
+
         void setBlocking(bool block);
 
         // only makes sense on tcp connected sockets - no enforcement
@@ -61,6 +66,16 @@ namespace Kelvin {
 
     ///////////////////////////////////////////////////////////////////////////
 
+    /// a range of completed MSG_ZEROCOPY sends (sequence numbers lo..hi inclusive).  copied if
+    /// the kernel fell back to copying (ie loopback).
+    struct ZeroCopyRange {
+        uint32_t lo;
+        uint32_t hi;
+        bool copied;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+
     class ConnectedSocket : public Socket {
         /* a socket that may be bound or connected */
 
@@ -71,8 +86,31 @@ namespace Kelvin {
         /// Prepare the socket for calls to recvMultiple.
         /// This must be called before any calls to recvMultiple so the
         /// proper data members are initialized.
+        /// @param buffer_count Maximum number of messages returned per recvMultiple
+        /// @param buffer_size Size of each message buffer (with GRO, raised to MaxGROSize)
         ///
-        void enableRecvMultiple();
+        void enableRecvMultiple(int buffer_count=DefaultBufferCount,
+                                int buffer_size=DefaultBufferSize);
+
+        ///
+        /// UDP_GRO, the kernel coalesces datagrams into one buffer and recvMultiple
+        /// splits them back out.  Coalesced buffers are up to MaxGROSize, so call before
+        /// enableRecvMultiple (which then sizes its buffers for them).  Returns false if not
+        /// supported.
+        ///
+        bool enableGRO();
+
+        ///
+        /// UDP_SEGMENT (GSO), each send of up to 64KB is split by the kernel into
+        /// segment_size datagrams.  0 turns it off.  Returns false if not supported.
+        ///
+        bool setSendSegmentSize(int segment_size);
+
+        ///
+        /// SO_TIMESTAMPNS, recvMultiple records the kernel receive time of each message
+        /// (see getRecvTimestamps()).  Returns false if not supported.
+        ///
+        bool enableRecvTimestamps();
 
       public:
         int recv(char* buf, int size, int flags=0);
@@ -84,8 +122,46 @@ namespace Kelvin {
         ///
         const std::vector<iovec>& recvMultiple(int flags=0);
 
+        ///
+        /// Messages recvMultiple dropped as they didn't fit their buffer (MSG_TRUNC), or their
+        /// control data (MSG_CTRUNC, so GRO segments couldn't be split).
+        ///
+        uint64_t getTruncatedCount() const {
+            return this->truncated_count;
+        }
+
+        ///
+        /// Kernel receive times (CLOCK_REALTIME) from the last recvMultiple, one per
+        /// returned iovec.  Zero if the kernel gave no timestamp.
+        ///
+        const std::vector<timespec>& getRecvTimestamps() const {
+            return this->recvmmsg_timestamps;
+        }
+
         int send(const char* buf, int size, int flags=0);
 
+        ///
+        /// Send multiple datagrams with one sendmmsg
+        /// @return The number of messages sent, -1 on EAGAIN
+        ///
+        int sendMultiple(const struct iovec* messages, int count, int flags=0);
+
+        // sendmsg() gather, returns -1 on EAGAIN like send()
+        int sendGather(const struct iovec* msg_iov, int msg_iovlen, int flags=0);
+
+        /// SO_ZEROCOPY, returns false if not supported
+        bool enableZeroCopy();
+
+        /// send() with MSG_ZEROCOPY, buf must stay untouched until its completion is read.
+        /// Each call that sends something is given the next sequence number (starting at 0).
+        /// Returns -1 on EAGAIN, ZEROCOPY_NOBUFS if the kernel won't pin any more pages (use
+        /// send() instead).
+        int sendZeroCopy(const char* buf, int size, int flags=0);
+        static constexpr int ZEROCOPY_NOBUFS = -2;
+
+        /// reads MSG_ZEROCOPY completions off the error queue, returns the number of ranges
+        int readZeroCopyCompletions(ZeroCopyRange* ranges, int max_ranges);
+
       public:
         int default_send_flags;
 
@@ -95,21 +171,43 @@ namespace Kelvin {
       private:
         // Members for use with recvMultiple
 
-        // Maximum number of buffers to write messages into
-        constexpr static int MaxBufferCount = 128;
-        constexpr static int MaxBufferSize = 2048;
+        // Defaults for the number of buffers to write messages into, and their size
+        constexpr static int DefaultBufferCount = 128;
+        constexpr static int DefaultBufferSize = 2048;
+
+        // Largest buffer GRO coalesces into
+        constexpr static int MaxGROSize = 65536;
+
+        // Space for control messages, per message
+        constexpr static int ControlSize = 64;
+
+        int buffer_count;
+        int buffer_size;
 
-        // Array of mmshdr structs that contain msg_hdr and msg_len
-        mmsghdr mmheaders[MaxBufferCount];
+        // mmshdr structs that contain msg_hdr and msg_len
+        std::vector<mmsghdr> mmheaders;
 
-        // Array of iovec structs that contain a pointer to the buffer and its length
-        iovec iov[MaxBufferCount];
+        // iovec structs that contain a pointer to the buffer and its length
+        std::vector<iovec> iov;
 
         // Buffers for storing data from recvmmsg
         std::unique_ptr<char[]> recvmmsg_buffer;
 
+        // Control message buffers, only used if recv_control (ie GRO or timestamps)
+        std::unique_ptr<char[]> recvmmsg_control;
+        bool recv_control;
+        bool gro_enabled;
+        bool timestamps_enabled;
+        uint64_t truncated_count;
+
         // Vector used to return the buffers and sizes from recvmmsg
         std::vector<iovec> recvmmsg_results;
+
+        // Parallel to recvmmsg_results, if timestamps_enabled
+        std::vector<timespec> recvmmsg_timestamps;
+
+        // Members for use with sendMultiple
+        std::vector<mmsghdr> send_headers;
     };
 
     ///////////////////////////////////////////////////////////////////////////
@@ -171,7 +269,11 @@ namespace Kelvin {
       public:
         bool isListening();
         void listen(int backlog);
-        ConnectedSocket* accept();
+
+        // the new socket is non blocking and close on exec.  nullptr if nothing to accept, or
+        // if the process/system is out of fds - in which case out_of_fds is set (the connection
+        // stays in the backlog, and the listening socket stays readable).
+        ConnectedSocket* accept(bool* out_of_fds=nullptr);
 
       protected:
         virtual struct sockaddr* getAddr();
@@ -184,7 +286,9 @@ namespace Kelvin {
 
     class TcpAcceptingSocket : public AcceptingSocket {
       public:
-        TcpAcceptingSocket(const std::string& ipaddr, int port);
+        // reuse_port (SO_REUSEPORT) lets several sockets bind the same port, with the kernel
+        // balancing connections between them
+        TcpAcceptingSocket(const std::string& ipaddr, int port, bool reuse_port=false);
         virtual ~TcpAcceptingSocket();
 
       protected:
@@ -13,6 +13,9 @@
 // std includes
 #include <errno.h>
 #include <string>
+#include <limits>
+#include <algorithm>
+#include <sys/uio.h>
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -23,19 +26,37 @@ using namespace Kelvin::Streamer;
 
 static const bool _debug_log = false;
 #define TRACE(fmt, args...) if (_debug_log) { K273::l_debug(fmt, ## args); }
+
+// max segments handed to a single sendmsg()
+#define MAX_GATHER_IOV 64
 ///////////////////////////////////////////////////////////////////////////////
 
 StreamHandler::StreamHandler(Scheduler* scheduler, StreamProtocol* protocol) :
     key(nullptr),
     scheduler(scheduler),
     protocol(protocol),
-    // XXX how dow we make these more configurable?
-    inbuf(1024 * 128),
-    outbuf(1024 * 128),
+    inbuf(0),
+    inbuf_pool(scheduler->getInputPool()),
+    inbuf_slab(nullptr),
+    ring_inbuf(nullptr),
+    ring_max_capacity(0),
+    dispatching(false),
+    pending_ring_capacity(0),
+    pending_ring_max_capacity(0),
+    outbuf(scheduler->getOutputPool()),
+    low_watermark(256 * 1024),
+    high_watermark(1024 * 1024),
+    producing_paused(false),
     timeout_secs(0),
+    read_budget(1024 * 256),
     write_waiting_for_os(false),
-    last_update_read_time_at(0.0),
+    corked(false),
+    flush_threshold(64 * 1024),
+    zerocopy(false),
+    zerocopy_threshold(64 * 1024),
+    zerocopy_next_seq(0),
     read_timeout_cb(scheduler, this),
+    flush_cb(scheduler, this),
     sock(nullptr) {
     TRACE("creating StreamHandler %p", this);
 }
@@ -46,6 +67,11 @@ StreamHandler::~StreamHandler() {
     //}
 
     this->read_timeout_cb.cancel();
+    this->flush_cb.cancel();
+
+    delete this->ring_inbuf;
+    this->releaseInput();
+    this->releaseZeroCopy();
 
     TRACE("destroying StreamHandler %p", this);
 }
@@ -54,33 +80,133 @@ void StreamHandler::doRead(SelectionKey* key) {
     TRACE("StreamHandler::doRead()");
     ASSERT (this->isConnected());
 
-    int count = 0;
-    char* ptbuf = this->inbuf.getInternalBuf();
+    // Level triggered, a single recv() - the selector will tell us again if there is more.
+    // Edge triggered, read until the socket is drained or the budget is used up (in which case
+    // the selector re-delivers us next iteration, after everyone else has had a go).
+    const bool edge_triggered = key->isEdgeTriggered();
+    int budget = this->read_budget;
+    bool first = true;
+
+    // completions show up as POLLERR, ie as readable
+    if (!this->zerocopy_pending.empty()) {
+        this->reapZeroCopy();
+        if (!this->isConnected()) {
+            return;
+        }
+    }
 
-    try {
-        count = this->sock->recv(ptbuf, this->inbuf.remaining());
+    while (true) {
+        char* ptbuf = nullptr;
+        int wanted = 0;
 
-    } catch (const Kelvin::SocketError& exc) {
-        K273::l_info("Error reading from socket (fd=%d) in %s :\n  %s",
-               this->sock->fileno(), this->protocol->repr().c_str(),
-               exc.getMessage().c_str());
+        if (this->ring_inbuf != nullptr) {
+            RingBuffer* ring = this->ring_inbuf;
 
-        this->disconnected();
-        return;
-    }
+            // full and the protocol is waiting on more of a frame, make room (capacities are
+            // powers of 2, so doubling is the next size up - and may not overshoot the max)
+            if (ring->writable() == 0 && ring->capacity() * 2 <= this->ring_max_capacity) {
+                ring->grow(ring->capacity() * 2);
+            }
 
-    if (count <= 0) {
-        K273::l_debug("Zero length read from socket (fd=%d) in %s [count=%d, errno=%d: '%s']",
-                      this->sock->fileno(), this->protocol->repr().c_str(),
-                      count, errno, strerror(errno));
-        this->disconnected();
-        return;
-    }
+            ptbuf = ring->writePtr();
+            wanted = (int) ring->writable();
+
+        } else {
+            if (this->inbuf_slab == nullptr) {
+                this->acquireInput();
+            }
+
+            ptbuf = this->inbuf.getInternalBuf();
+            wanted = this->inbuf.remaining();
+        }
+
+        if (edge_triggered) {
+            wanted = std::min(wanted, budget);
+        }
+
+        // The input is full (ring at its max) and the protocol consumed none of it, so it is
+        // waiting on a frame bigger than we can hold.  Returning would spin forever level
+        // triggered (or be redelivered forever edge triggered) - nothing else will make room.
+        if (wanted == 0) {
+            K273::l_error("Input full, frame too large for buffer (fd=%d) in %s, disconnecting",
+                          this->sock->fileno(), this->protocol->repr().c_str());
+            this->disconnected();
+            return;
+        }
+
+        int count = 0;
+        try {
+            count = this->sock->recv(ptbuf, wanted);
+
+        } catch (const Kelvin::SocketError& exc) {
+            K273::l_info("Error reading from socket (fd=%d) in %s :\n  %s",
+                   this->sock->fileno(), this->protocol->repr().c_str(),
+                   exc.getMessage().c_str());
+
+            this->disconnected();
+            return;
+        }
 
-    this->inbuf.skip(count);
+        if (count < 0) {
+            // EAGAIN (level triggered, only zero copy completions were ready)
+            if (edge_triggered) {
+                key->drained(OP_READ);
+            }
 
-    this->updateReadTimeout();
-    this->protocol->dataReceived(this->inbuf);
+            if (this->inbuf.remaining() == this->inbuf.getCapacity()) {
+                this->releaseInput();
+            }
+
+            return;
+        }
+
+        if (count <= 0) {
+            K273::l_debug("Zero length read from socket (fd=%d) in %s [count=%d, errno=%d: '%s']",
+                          this->sock->fileno(), this->protocol->repr().c_str(),
+                          count, errno, strerror(errno));
+            this->disconnected();
+            return;
+        }
+
+        if (first) {
+            this->updateReadTimeout();
+            first = false;
+        }
+
+        this->dispatching = true;
+        if (this->ring_inbuf != nullptr) {
+            this->ring_inbuf->produced(count);
+            this->ringDataReceived();
+            this->dispatching = false;
+
+        } else {
+            this->inbuf.skip(count);
+            this->protocol->dataReceived(this->inbuf);
+            this->dispatching = false;
+
+            // all consumed, an idle connection holds no input memory
+            if (this->inbuf.remaining() == this->inbuf.getCapacity()) {
+                this->releaseInput();
+            }
+        }
+
+        this->applyPendingRingInput();
+
+        if (!edge_triggered || !this->isConnected()) {
+            return;
+        }
+
+        // a short read on a stream socket means it is drained, saves a recv() just to get EAGAIN
+        if (count < wanted) {
+            key->drained(OP_READ);
+            return;
+        }
+
+        budget -= count;
+        if (budget <= 0) {
+            return;
+        }
+    }
 }
 
 void StreamHandler::doWrite(SelectionKey* key) {
@@ -89,47 +215,330 @@ void StreamHandler::doWrite(SelectionKey* key) {
 
     // XXX why test this flag???  Shouldn't it be an assert? XXX
     if (this->write_waiting_for_os) {
+        if (!this->sendPending()) {
+            return;
+        }
 
-        // XXX not sure why we have to removeOps also - shouldn't selector do this?
-        this->key->removeOps(OP_WRITE);
-        this->write_waiting_for_os = false;
+        if (this->outbuf.empty()) {
+            this->key->removeOps(OP_WRITE);
+            this->write_waiting_for_os = false;
 
-        this->outbuf.flip();
-        if (this->outbuf.remaining() == 0) {
-            this->outbuf.clear();
-            return;
+        } else {
+            // socket buffer is full again
+            this->key->drained(OP_WRITE);
+        }
+
+        this->checkWatermarks();
+    }
+}
+
+bool StreamHandler::sendPending() {
+    struct iovec iov[MAX_GATHER_IOV];
+
+    while (!this->outbuf.empty()) {
+        const int iov_count = this->outbuf.gather(iov, MAX_GATHER_IOV);
+
+        size_t wanted = 0;
+        for (int ii=0; ii<iov_count; ii++) {
+            wanted += iov[ii].iov_len;
         }
 
         int count = 0;
         try {
-            count = this->sock->send(this->outbuf.getInternalBuf(),
-                                     this->outbuf.remaining());
+            count = this->sock->sendGather(iov, iov_count);
 
         } catch (const Kelvin::SocketError& exc) {
             K273::l_warning("Error writing to socket (fd=%d) in %s :\n  %s",
                             this->sock->fileno(), this->protocol->repr().c_str(),
                             exc.getMessage().c_str());
             this->disconnected();
+            return false;
+        }
+
+        // EAGAIN
+        if (count <= 0) {
+            break;
+        }
+
+        this->outbuf.consume(count);
+
+        // short write, the socket buffer is full
+        if ((size_t) count < wanted) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+void StreamHandler::checkWatermarks() {
+    const int64_t pending = this->outbuf.size();
+
+    if (!this->producing_paused && pending >= this->high_watermark) {
+        TRACE("pauseProducing() pending %ld", pending);
+        this->producing_paused = true;
+        this->protocol->pauseProducing();
+
+    } else if (this->producing_paused && pending <= this->low_watermark) {
+        TRACE("resumeProducing() pending %ld", pending);
+        this->producing_paused = false;
+        this->protocol->resumeProducing();
+    }
+}
+
+void StreamHandler::ringDataReceived() {
+    RingBuffer* ring = this->ring_inbuf;
+    const int readable = (int) ring->readable();
+
+    // a view, the protocol consumes by reading/skipping
+    ByteBuffer view(readable, ring->readPtr());
+    this->protocol->onBuffer(view);
+
+    ring->consume(readable - view.remaining());
+}
+
+static size_t ringGrowsTo(size_t capacity, size_t max_capacity) {
+    // see the doubling in doRead()
+    while (capacity * 2 <= max_capacity) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+int StreamHandler::getMaxInput() const {
+    if (this->pending_ring_capacity != 0) {
+        size_t capacity = RingBuffer::sizeFor(this->pending_ring_capacity);
+        if (this->ring_inbuf != nullptr) {
+            capacity = std::max(capacity, this->ring_inbuf->capacity());
+        }
+
+        return (int) ringGrowsTo(capacity, this->pending_ring_max_capacity);
+    }
+
+    if (this->ring_inbuf != nullptr) {
+        return (int) ringGrowsTo(this->ring_inbuf->capacity(), this->ring_max_capacity);
+    }
+
+    return this->inbuf_pool.getSlabSize();
+}
+
+void StreamHandler::setRingInput(size_t initial_capacity, size_t max_capacity) {
+    ASSERT (initial_capacity > 0 && initial_capacity <= max_capacity);
+    ASSERT (max_capacity <= (size_t) std::numeric_limits <int>::max());
+
+    // Inside onBuffer() the input is flipped and partly consumed (or is the ring, under the
+    // protocol's view), so switch once it returns.
+    if (this->dispatching) {
+        this->pending_ring_capacity = initial_capacity;
+        this->pending_ring_max_capacity = max_capacity;
+        return;
+    }
+
+    if (this->ring_inbuf == nullptr) {
+        this->ring_inbuf = new RingBuffer(initial_capacity);
+
+        // anything already read and not consumed
+        this->inbuf.flip();
+        const int pending = this->inbuf.remaining();
+        this->ring_inbuf->grow(pending);
+        this->inbuf.read(this->ring_inbuf->writePtr(), pending);
+        this->ring_inbuf->produced(pending);
+        this->releaseInput();
+
+    } else {
+        this->ring_inbuf->grow(initial_capacity);
+    }
+
+    this->ring_max_capacity = max_capacity;
+}
+
+void StreamHandler::applyPendingRingInput() {
+    if (this->pending_ring_capacity != 0) {
+        const size_t initial_capacity = this->pending_ring_capacity;
+        this->pending_ring_capacity = 0;
+        this->setRingInput(initial_capacity, this->pending_ring_max_capacity);
+    }
+}
+
+void StreamHandler::clearInput() {
+    this->releaseInput();
+    if (this->ring_inbuf != nullptr) {
+        this->ring_inbuf->clear();
+    }
+}
+
+void StreamHandler::acquireInput() {
+    ASSERT (this->inbuf_slab == nullptr);
+    this->inbuf_slab = this->inbuf_pool.acquire();
+    this->inbuf.setBuffer(this->inbuf_slab, this->inbuf_pool.getSlabSize());
+}
+
+void StreamHandler::releaseInput() {
+    if (this->inbuf_slab != nullptr) {
+        this->inbuf.setBuffer(nullptr, 0);
+        this->inbuf_pool.release(this->inbuf_slab);
+        this->inbuf_slab = nullptr;
+    }
+}
+
+bool StreamHandler::setZeroCopy(bool enable, int threshold) {
+    ASSERT (this->isConnected());
+
+    this->zerocopy_threshold = threshold;
+    if (enable && !this->zerocopy) {
+        this->zerocopy = this->sock->enableZeroCopy();
+        return this->zerocopy;
+    }
+
+    // can't turn off SO_ZEROCOPY, just stop using MSG_ZEROCOPY
+    this->zerocopy = enable && this->zerocopy;
+    return true;
+}
+
+void StreamHandler::writeZeroCopy(const char* data, int size, std::function <void()> release) {
+    ASSERT (this->isConnected());
+
+    // keep ordering, corked data goes first
+    if (this->corked) {
+        this->flush();
+        if (!this->isConnected()) {
+            release();
             return;
         }
+    }
+
+    if (!this->zerocopy || size < this->zerocopy_threshold || this->write_waiting_for_os) {
+        this->write(data, size);
+        release();
+        return;
+    }
+
+    int written_count = 0;
+    try {
+        written_count = this->sock->sendZeroCopy(data, size);
+
+    } catch (const Kelvin::SocketError& exc) {
+        K273::l_warning("Error writing to socket (fd=%d) in %s :\n  %s",
+                        this->sock->fileno(), this->protocol->repr().c_str(),
+                        exc.getMessage().c_str());
+        release();
+        this->disconnected();
+        return;
+    }
 
-        if (count < this->outbuf.remaining()) {
-            // re-register read interest with request socket
-            this->key->addOps(OP_WRITE);
-            this->write_waiting_for_os = true;
+    // EAGAIN or out of pinned pages, nothing was sent
+    if (written_count < 0) {
+        this->write(data, size);
+        release();
+        return;
+    }
+
+    // the kernel references data until its completion
+    this->zerocopy_pending.emplace_back(this->zerocopy_next_seq++, std::move(release));
+
+    if (written_count < size) {
+        // copy the rest
+        this->outbuf.append(data + written_count, size - written_count);
+
+        this->key->drained(OP_WRITE);
+        this->key->addOps(OP_WRITE);
+        this->write_waiting_for_os = true;
+
+        this->checkWatermarks();
+    }
+}
+
+void StreamHandler::reapZeroCopy() {
+    ZeroCopyRange ranges[16];
+
+    while (true) {
+        int count = 0;
+        try {
+            count = this->sock->readZeroCopyCompletions(ranges, 16);
+
+        } catch (const Kelvin::SocketError& exc) {
+            K273::l_warning("Error reading error queue (fd=%d) in %s :\n  %s",
+                            this->sock->fileno(), this->protocol->repr().c_str(),
+                            exc.getMessage().c_str());
+            this->disconnected();
+            return;
         }
 
-        if (count <= 0) {
-            this->outbuf.compact();
+        if (count == 0) {
             return;
         }
 
-        ASSERT (count <= this->outbuf.remaining());
-        this->outbuf.skip(count);
-        this->outbuf.compact();
+        for (int ii=0; ii<count; ii++) {
+            const ZeroCopyRange& range = ranges[ii];
+            TRACE("zero copy completed %u..%u copied %d", range.lo, range.hi, range.copied);
+
+            // completions are almost always in order, but needn't be (wrapping compare)
+            auto it = this->zerocopy_pending.begin();
+            while (it != this->zerocopy_pending.end()) {
+                if (it->first - range.lo <= range.hi - range.lo) {
+                    std::function <void()> release = std::move(it->second);
+                    it = this->zerocopy_pending.erase(it);
+                    release();
+
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+}
+
+void StreamHandler::releaseZeroCopy() {
+    // the socket is gone, we won't hear any more
+    while (!this->zerocopy_pending.empty()) {
+        std::function <void()> release = std::move(this->zerocopy_pending.front().second);
+        this->zerocopy_pending.pop_front();
+        release();
+    }
+
+    // sequence numbers and SO_ZEROCOPY are per socket
+    this->zerocopy_next_seq = 0;
+    this->zerocopy = false;
+}
+
+void StreamHandler::setCorked(bool corked, int flush_threshold) {
+    ASSERT (flush_threshold > 0);
+    this->corked = corked;
+    this->flush_threshold = flush_threshold;
+
+    if (!corked && this->isConnected()) {
+        this->flush();
     }
 }
 
+void StreamHandler::flush() {
+    this->flush_cb.cancel();
+
+    // if waiting on the OS, doWrite() will send it
+    if (!this->isConnected() || this->write_waiting_for_os || this->outbuf.empty()) {
+        return;
+    }
+
+    if (!this->sendPending()) {
+        return;
+    }
+
+    if (!this->outbuf.empty()) {
+        this->key->drained(OP_WRITE);
+        this->key->addOps(OP_WRITE);
+        this->write_waiting_for_os = true;
+    }
+
+    this->checkWatermarks();
+}
+
+void StreamHandler::setWriteWatermarks(int64_t low, int64_t high) {
+    ASSERT (low >= 0 && low <= high);
+    this->low_watermark = low;
+    this->high_watermark = high;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 bool StreamHandler::isConnected() {
@@ -162,36 +571,57 @@ void StreamHandler::disconnect() {
 void StreamHandler::write(const char* data, int size) {
     ASSERT (this->isConnected());
 
-    int written_count = 0;
-    if (!this->write_waiting_for_os) {
-        try {
-            written_count = this->sock->send(data, size);
+    // already waiting on the OS, queue behind what is pending
+    if (this->write_waiting_for_os) {
+        this->outbuf.append(data, size);
+        this->checkWatermarks();
+        return;
+    }
 
-        } catch (const Kelvin::SocketError& exc) {
-            K273::l_warning("Error writing to socket (fd=%d) in %s :\n  %s",
-                            this->sock->fileno(), this->protocol->repr().c_str(),
-                            exc.getMessage().c_str());
-            this->disconnected();
-            return;
-        }
+    if (this->corked) {
+        this->outbuf.append(data, size);
 
-        // good job?
-        if (written_count == size) {
-            return;
+        if (this->outbuf.size() >= this->flush_threshold) {
+            this->flush();
+
+        } else {
+            // does nothing if already scheduled
+            this->flush_cb.callLater(0);
+            this->checkWatermarks();
         }
 
-        // XXX tmp
-        ASSERT (written_count < size);
+        return;
+    }
 
-        // XXX handle overrunning buffers...
-        // append to write buffer
-        written_count = std::max(0, written_count);
-        this->outbuf.write(data + written_count, size - written_count);
+    int written_count = 0;
+    try {
+        written_count = this->sock->send(data, size);
 
-        // register read interest with request socket
-        this->key->addOps(OP_WRITE);
-        this->write_waiting_for_os = true;
+    } catch (const Kelvin::SocketError& exc) {
+        K273::l_warning("Error writing to socket (fd=%d) in %s :\n  %s",
+                        this->sock->fileno(), this->protocol->repr().c_str(),
+                        exc.getMessage().c_str());
+        this->disconnected();
+        return;
+    }
+
+    // good job?
+    if (written_count == size) {
+        return;
     }
+
+    ASSERT (written_count < size);
+
+    // append the rest to the output chain (unbounded, see setWriteWatermarks())
+    written_count = std::max(0, written_count);
+    this->outbuf.append(data + written_count, size - written_count);
+
+    // register write interest with request socket
+    this->key->drained(OP_WRITE);
+    this->key->addOps(OP_WRITE);
+    this->write_waiting_for_os = true;
+
+    this->checkWatermarks();
 }
 
 void StreamHandler::setReadTimeout(int timeout_secs) {
@@ -218,21 +648,13 @@ void StreamHandler::disconnected() {
 void StreamHandler::updateReadTimeout() {
     ASSERT (this->isConnected());
 
-    // cancel the timer if exists
-    this->read_timeout_cb.cancel();
-
+    // resetting is O(1) and doesn't allocate (intrusive timer in the wheel), so just do it
     if (this->timeout_secs > 0) {
-
-        // fudge it, so we don't recreate this timer excessive
-        double current_time = K273::get_time();
-        if (current_time < this->last_update_read_time_at + 0.5) {
-            return;
-        }
-
-        this->last_update_read_time_at = current_time;
-
         TRACE("updateReadTimeout");
-        this->read_timeout_cb.callLater(this->timeout_secs * 1000);
+        this->read_timeout_cb.callLater(this->timeout_secs * 1000, true);
+
+    } else {
+        this->read_timeout_cb.cancel();
     }
 }
 
@@ -284,6 +706,14 @@ string StreamProtocol::repr() const {
     return "StreamProtocol";
 }
 
+void StreamProtocol::pauseProducing() {
+    TRACE("pauseProducing() %s", this->repr().c_str());
+}
+
+void StreamProtocol::resumeProducing() {
+    TRACE("resumeProducing() %s", this->repr().c_str());
+}
+
 void StreamProtocol::disconnect() {
     // doesn't care if we are logically connected or not
     if (this->handler->isConnected()) {
@@ -317,6 +747,41 @@ void StreamProtocol::setReadTimeout(int timeout_secs) {
     this->handler->setReadTimeout(timeout_secs);
 }
 
+void StreamProtocol::setWriteWatermarks(int64_t low, int64_t high) {
+    this->handler->setWriteWatermarks(low, high);
+}
+
+void StreamProtocol::setRingInput(size_t initial_capacity, size_t max_capacity) {
+    this->handler->setRingInput(initial_capacity, max_capacity);
+}
+
+int StreamProtocol::getMaxInput() const {
+    return this->handler->getMaxInput();
+}
+
+void StreamProtocol::setCorked(bool corked, int flush_threshold) {
+    this->handler->setCorked(corked, flush_threshold);
+}
+
+bool StreamProtocol::setZeroCopy(bool enable, int threshold) {
+    return this->handler->setZeroCopy(enable, threshold);
+}
+
+void StreamProtocol::writeZeroCopy(const char* ptdata, int size, std::function <void()> release) {
+    if (this->isConnected()) {
+        this->handler->writeZeroCopy(ptdata, size, std::move(release));
+    } else {
+        K273::l_warning("call to write being dropped - but not connected : %s", this->repr().c_str());
+        release();
+    }
+}
+
+void StreamProtocol::flush() {
+    if (this->isConnected()) {
+        this->handler->flush();
+    }
+}
+
 Kelvin::ConnectedSocket* StreamProtocol::getSocket() {
     if (this->handler->isConnected()) {
         return this->handler->getSocket();
@@ -5,6 +5,14 @@
 #include "kelvin/selector.h"
 #include "kelvin/scheduler.h"
 #include "kelvin/bytebuffer.h"
+#include "kelvin/outchain.h"
+#include "kelvin/slabpool.h"
+#include "kelvin/ringbuffer.h"
+
+// std includes
+#include <deque>
+#include <utility>
+#include <functional>
 
 namespace Kelvin::Streamer {
 
@@ -39,6 +47,47 @@ namespace Kelvin::Streamer {
         void setReadTimeout(int timeout_secs);
         ConnectedSocket* getSocket();
 
+        /// When pending output reaches high bytes the protocol is told to pauseProducing(), and
+        /// once it drains back down to low to resumeProducing().
+        void setWriteWatermarks(int64_t low, int64_t high);
+
+        int64_t getPendingWriteBytes() const {
+            return this->outbuf.size();
+        }
+
+        // max bytes read per wakeup when edge triggered, so one busy socket can't starve the
+        // rest.  Any more is read on the next loop iteration.
+        void setReadBudget(int read_budget) {
+            this->read_budget = read_budget;
+        }
+
+        /// Reads go straight into a double mapped ring, and the protocol's onBuffer() is handed
+        /// a view of everything unconsumed - so partial messages are never compacted.  Note
+        /// dataReceived() is bypassed.  The ring doubles (never beyond max_capacity) when full
+        /// and nothing was consumed, ie for frames larger than it.  Called from inside
+        /// onBuffer(), takes effect once onBuffer() returns (with whatever it left unconsumed).
+        void setRingInput(size_t initial_capacity=64 * 1024,
+                          size_t max_capacity=16 * 1024 * 1024);
+
+        /// largest amount of unconsumed input that can be held, ie the largest message a
+        /// protocol can wait on (the slab size, or the largest the ring can grow to)
+        int getMaxInput() const;
+
+        /// Zero copy sends (MSG_ZEROCOPY) for writeZeroCopy()s of at least threshold bytes.
+        /// Returns false if the socket doesn't support it (writeZeroCopy() then always copies).
+        bool setZeroCopy(bool enable, int threshold=64 * 1024);
+
+        /// release is called once the kernel is done with data - which must not be touched until
+        /// then.  Small writes, or if anything is already pending, are copied (and released
+        /// straight away).
+        void writeZeroCopy(const char* data, int size, std::function <void()> release);
+
+        /// Corked, write()s are only appended to the pending output, and sent with a single
+        /// sendmsg() at the end of the scheduler iteration (via a callLater(0)) - or as soon as
+        /// flush_threshold bytes are pending.  Uncorking flushes.
+        void setCorked(bool corked, int flush_threshold=64 * 1024);
+
+        /// send pending output now (ie for latency critical messages when corked)
         void flush();
 
       protected:
@@ -47,22 +96,70 @@ namespace Kelvin::Streamer {
 
         void updateReadTimeout();
         void cleanupSocket();
+        void clearInput();
+
+        // inbuf borrows a slab from the pool while it holds data
+        void acquireInput();
+        void releaseInput();
+
+        // zero copy completions, off the socket's error queue
+        void reapZeroCopy();
+        void releaseZeroCopy();
+
+        // hands the ring's unconsumed data to the protocol
+        void ringDataReceived();
+
+        // a setRingInput() made during dispatch
+        void applyPendingRingInput();
+
+        // send as much of outbuf as the socket will take, returns false if disconnected
+        bool sendPending();
+        void checkWatermarks();
 
       protected:
         SelectionKey* key;
         Scheduler* scheduler;
         StreamProtocol* protocol;
 
+        // no memory of its own, see acquireInput()
         ByteBuffer inbuf;
-        ByteBuffer outbuf;
+        SlabPool& inbuf_pool;
+        char* inbuf_slab;
+
+        // if set, used instead of inbuf (see setRingInput())
+        RingBuffer* ring_inbuf;
+        size_t ring_max_capacity;
+
+        // in the protocol's onBuffer(), and a setRingInput() made there (0 if none)
+        bool dispatching;
+        size_t pending_ring_capacity;
+        size_t pending_ring_max_capacity;
+
+        // pending output, unbounded (see setWriteWatermarks())
+        OutputChain outbuf;
+        int64_t low_watermark;
+        int64_t high_watermark;
+        bool producing_paused;
 
         int timeout_secs;
+        int read_budget;
         bool write_waiting_for_os;
-        double last_update_read_time_at;
+
+        bool corked;
+        int flush_threshold;
+
+        // MSG_ZEROCOPY sends waiting on the kernel, by sequence number
+        bool zerocopy;
+        int zerocopy_threshold;
+        uint32_t zerocopy_next_seq;
+        std::deque <std::pair <uint32_t, std::function <void()>>> zerocopy_pending;
 
         DEFERRED(ReadTimeout, StreamHandler, doReadTimeout);
         ReadTimeout read_timeout_cb;
 
+        DEFERRED(FlushLater, StreamHandler, flush);
+        FlushLater flush_cb;
+
         ConnectedSocket* sock;
     };
 
@@ -82,6 +179,11 @@ namespace Kelvin::Streamer {
         virtual void connectionLost();
         virtual std::string repr() const;
 
+        // pending output has crossed the high watermark / drained to the low watermark.
+        // Protocols that can throttle should stop/start writing.
+        virtual void pauseProducing();
+        virtual void resumeProducing();
+
       public:
         // fixed api
         void disconnect();
@@ -91,6 +193,14 @@ namespace Kelvin::Streamer {
         void write(ByteBuffer& buf);
 
         void setReadTimeout(int timeout_secs);
+        void setWriteWatermarks(int64_t low, int64_t high);
+        void setRingInput(size_t initial_capacity=64 * 1024,
+                          size_t max_capacity=16 * 1024 * 1024);
+        int getMaxInput() const;
+        void setCorked(bool corked, int flush_threshold=64 * 1024);
+        void flush();
+        bool setZeroCopy(bool enable, int threshold=64 * 1024);
+        void writeZeroCopy(const char* ptdata, int size, std::function <void()> release);
         ConnectedSocket* getSocket();
 
       protected:
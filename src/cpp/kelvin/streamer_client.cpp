@@ -131,7 +131,7 @@ void ConnectingHandler::initiateConnect() {
         // do nothing, will clean up with OP_CONNECT
     }
 
-    this->key = this->scheduler->registerHandler(this, connecting_sock->fileno(), OP_CONNECT);
+    this->key = this->scheduler->registerHandler(this, connecting_sock->fileno(), OP_CONNECT | OP_EDGE);
 
     // hang on to it
     this->sock = connecting_sock;
@@ -169,13 +169,16 @@ void ConnectingHandler::disconnected() {
 
         // cancel the flush and clear buffers
         this->outbuf.clear();
-        this->inbuf.clear();
+        this->flush_cb.cancel();
+        this->releaseZeroCopy();
+        this->clearInput();
 
         // cancel the timer if exists
         this->read_timeout_cb.cancel();
 
         // reset flag
         this->write_waiting_for_os = false;
+        this->producing_paused = false;
 
         // now we are not connected
         this->is_connected = false;
@@ -9,12 +9,14 @@
 #include "kelvin/bytebuffer.h"
 
 // k273 includes
+#include <k273/util.h>
 #include <k273/logging.h>
 #include <k273/strutils.h>
 
 // std includes
 #include <errno.h>
 #include <string>
+#include <cstring>
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -27,6 +29,9 @@ using namespace Kelvin::Streamer;
 static const bool _debug_log = false;
 #define TRACE(fmt, args...) if (_debug_log) { K273::l_debug(fmt, ## args); }
 
+// out of fds warnings, at most one every
+static const double FDS_WARNING_SECS = 10.0;
+
 ///////////////////////////////////////////////////////////////////////////////
 
 class ChildHandler : public StreamHandler {
@@ -67,15 +72,27 @@ public:
     // called via scheduler event handler
     virtual void doAccept(SelectionKey* key);
 
+    // called via deferred, after backing off when out of fds
+    void resumeAccepting();
+
     // called from ChildHandler
     void childConnected(ChildProtocol* child);
     void childDisconnected(ChildProtocol* child);
 
+    int getNumberChildren() const {
+        return this->children.size();
+    }
+
+    int64_t getRejectedCount() const {
+        return this->rejected_count;
+    }
+
     // required by EventHandler
     virtual std::string repr() const;
 
 private:
     void cleanup();
+    void pauseAccepting();
 
 private:
     Scheduler* scheduler;
@@ -85,10 +102,21 @@ private:
 
     SelectionKey* key;
     bool initialized;
+    int64_t rejected_count;
+
+    // out of fds: not accepting until resume_cb fires.  Warnings at most every
+    // FDS_WARNING_SECS, with a count of those suppressed.
+    bool accept_paused;
+    int64_t out_of_fds_count;
+    int64_t out_of_fds_warned;
+    double out_of_fds_last_warning;
 
     DEFERRED(Wakeup, ServerHandler, onWakeup);
     Wakeup deferred;
 
+    DEFERRED(ResumeAccepting, ServerHandler, resumeAccepting);
+    ResumeAccepting resume_cb;
+
     // XXX Use mapping?
     std::list <ChildProtocol*> children;
 };
@@ -103,7 +131,7 @@ ChildHandler::ChildHandler(Scheduler* scheduler,
     parent(parent),
     is_connected(false) {
     this->sock = conn_sock;
-    this->key = this->scheduler->registerHandler(this, this->sock->fileno(), OP_CONNECT);
+    this->key = this->scheduler->registerHandler(this, this->sock->fileno(), OP_CONNECT | OP_EDGE);
 }
 
 ChildHandler::~ChildHandler() {
@@ -139,12 +167,16 @@ void ChildHandler::disconnected() {
 
         // cancel the flush and clear buffers
         this->outbuf.clear();
+        this->flush_cb.cancel();
+        this->releaseZeroCopy();
+        this->clearInput();
 
         // cancel the timer if exists
         this->read_timeout_cb.cancel();
 
         // reset flag
         this->write_waiting_for_os = false;
+        this->producing_paused = false;
 
         // now we are not connected
         this->is_connected = false;
@@ -178,7 +210,13 @@ ServerHandler::ServerHandler(Server* server) :
     config(server->getConfig()),
     key(nullptr),
     initialized(false),
-    deferred(scheduler, this) {
+    rejected_count(0),
+    accept_paused(false),
+    out_of_fds_count(0),
+    out_of_fds_warned(0),
+    out_of_fds_last_warning(0.0),
+    deferred(scheduler, this),
+    resume_cb(scheduler, this) {
 
     // adopt accept socket
     this->accept_sock = this->config->accept_sock;
@@ -198,9 +236,10 @@ void ServerHandler::onWakeup() {
     // called once at startup to complete initialization
     this->accept_sock->listen(this->config->backlog);
     this->accept_sock->setBlocking(false);
+    TRACE("ServerHandler::onWakeup() listening, backlog %d", this->config->backlog);
     this->key = this->scheduler->registerHandler(this,
                                                  this->accept_sock->fileno(),
-                                                 OP_ACCEPT);
+                                                 OP_ACCEPT | OP_EDGE);
     this->initialized = true;
     TRACE("ServerHandler::onWakeup() initialized");
 }
@@ -209,22 +248,71 @@ void ServerHandler::doAccept(SelectionKey* key) {
     TRACE("ServerHandler::doAccept() socket accept");
     ASSERT (this->initialized);
 
-    while (true) {
-        ConnectedSocket* child_sock = this->accept_sock->accept();
+    // not draining (out of budget) means an edge triggered key is delivered again next pass
+    for (int ii=0; ii<this->config->accept_budget; ii++) {
+        bool out_of_fds = false;
+        ConnectedSocket* child_sock = this->accept_sock->accept(&out_of_fds);
+
+        // out of fds - the backlog isn't empty and the socket stays readable, so stop
+        // selecting on it for a while (or a level triggered selector spins)
+        if (out_of_fds) {
+            this->pauseAccepting();
+            break;
+        }
 
         // all done?
         if (child_sock == nullptr) {
+            key->drained(OP_ACCEPT);
             break;
         }
 
-        // set the socket non blocking
-        child_sock->setBlocking(false);
+        if (this->config->max_connections > 0 &&
+            (int) this->children.size() >= this->config->max_connections) {
+            TRACE("ServerHandler::doAccept() rejecting fd %d", child_sock->fileno());
+            child_sock->closeReset();
+            delete child_sock;
+            this->rejected_count++;
+            continue;
+        }
 
         ChildProtocol* child = this->config->createChild(this->server, child_sock);
         this->children.push_back(child);
     }
 }
 
+void ServerHandler::pauseAccepting() {
+    const int err = errno;
+
+    this->out_of_fds_count++;
+    const double now = K273::get_time();
+    if (now - this->out_of_fds_last_warning >= FDS_WARNING_SECS) {
+        K273::l_warning("ServerHandler out of fds (%s), not accepting for %d msecs "
+                        "(%ld times since last warning)",
+                        strerror(err), this->config->accept_backoff_msecs,
+                        (long) (this->out_of_fds_count - this->out_of_fds_warned));
+
+        this->out_of_fds_last_warning = now;
+        this->out_of_fds_warned = this->out_of_fds_count;
+    }
+
+    // deregister, registering again gets a fresh key (and for edge triggered, a fresh edge)
+    this->scheduler->registerHandler(this, this->accept_sock->fileno(), 0);
+    this->key = nullptr;
+    this->accept_paused = true;
+
+    this->resume_cb.callLater(this->config->accept_backoff_msecs);
+}
+
+void ServerHandler::resumeAccepting() {
+    ASSERT (this->accept_paused);
+    TRACE("ServerHandler::resumeAccepting()");
+
+    this->accept_paused = false;
+    this->key = this->scheduler->registerHandler(this,
+                                                 this->accept_sock->fileno(),
+                                                 OP_ACCEPT | OP_EDGE);
+}
+
 void ServerHandler::childConnected(ChildProtocol* child) {
     this->server->childConnectionMade(child);
 }
@@ -242,7 +330,12 @@ string ServerHandler::repr() const {
 void ServerHandler::cleanup() {
     if (this->initialized) {
         TRACE("ServerHandler::cleanup()");
-        this->key->cancel();
+        this->resume_cb.cancel();
+        if (this->key != nullptr) {
+            this->key->cancel();
+            this->key = nullptr;
+        }
+
         this->accept_sock->shutdown(false);
         this->accept_sock->close(false);
         this->initialized = false;
@@ -254,7 +347,10 @@ void ServerHandler::cleanup() {
 ConfigInterface::ConfigInterface(Scheduler* scheduler, AcceptingSocket* accept_sock, int backlog) :
     scheduler(scheduler),
     accept_sock(accept_sock),
-    backlog(backlog) {
+    backlog(backlog),
+    accept_budget(64),
+    max_connections(0),
+    accept_backoff_msecs(100) {
 }
 
 ConfigInterface::~ConfigInterface() {
@@ -282,6 +378,14 @@ void Server::childConnectionLost(ChildProtocol* child) {
     TRACE("Server::childConnectionLost %s", child->repr().c_str());
 }
 
+int Server::getNumberChildren() const {
+    return this->handler->getNumberChildren();
+}
+
+int64_t Server::getRejectedCount() const {
+    return this->handler->getRejectedCount();
+}
+
 string Server::repr() const {
     return "ServerProtocol";
 }
@@ -41,6 +41,16 @@ namespace Kelvin::Streamer {
         Scheduler* scheduler;
         AcceptingSocket* accept_sock;
         int backlog;
+
+        // max connections accepted per wakeup, any more are accepted on the next loop
+        // iteration (so a reconnect storm can't starve established connections)
+        int accept_budget;
+
+        // connections beyond this are accepted and reset straight away.  0 is no limit.
+        int max_connections;
+
+        // out of fds (EMFILE/ENFILE), stop accepting for this long before trying again
+        int accept_backoff_msecs;
     };
 
     template <typename ChildProtocol_t>
@@ -78,6 +88,11 @@ namespace Kelvin::Streamer {
             return this->handler;
         };
 
+        int getNumberChildren() const;
+
+        // connections reset as over config->max_connections
+        int64_t getRejectedCount() const;
+
     private:
         ConfigInterface* config;
         ServerHandler* handler;
@@ -85,16 +100,22 @@ namespace Kelvin::Streamer {
 
     ///////////////////////////////////////////////////////////////////////////
 
+    // the kernel caps backlog at net.core.somaxconn
+    constexpr int DEFAULT_BACKLOG = 4096;
+
     template <typename ChildProtocol_t>
-    ConfigInterface* unixConfigHelper(Scheduler* scheduler, const std::string& path) {
+    ConfigInterface* unixConfigHelper(Scheduler* scheduler, const std::string& path,
+                                      int backlog=DEFAULT_BACKLOG) {
         AcceptingSocket* accepting_socket = new UnixAcceptingSocket(path);
-        return new Config <ChildProtocol_t> (scheduler, accepting_socket, 10);
+        return new Config <ChildProtocol_t> (scheduler, accepting_socket, backlog);
     }
 
+    // reuse_port: one server per reactor can listen on the same port (see Reactors)
     template <typename ChildProtocol_t>
-    ConfigInterface* tcpConfigHelper(Scheduler* scheduler, const std::string& ipaddr, int port) {
-        AcceptingSocket* accepting_socket = new TcpAcceptingSocket(ipaddr, port);
-        return new Config <ChildProtocol_t> (scheduler, accepting_socket, 10);
+    ConfigInterface* tcpConfigHelper(Scheduler* scheduler, const std::string& ipaddr, int port,
+                                     bool reuse_port=false, int backlog=DEFAULT_BACKLOG) {
+        AcceptingSocket* accepting_socket = new TcpAcceptingSocket(ipaddr, port, reuse_port);
+        return new Config <ChildProtocol_t> (scheduler, accepting_socket, backlog);
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,309 @@
+// local includes
+#include "kelvin/timerwheel.h"
+#include "kelvin/scheduler.h"
+
+// k273 includes
+#include <k273/util.h>
+#include <k273/strutils.h>
+
+// std includes
+#include <string>
+#include <limits>
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+Timer::Timer(Deferred* a_deferred, unsigned int a_priority) :
+    deferred(a_deferred),
+    priority(a_priority),
+    trigger_at_time(-1),
+    prev(nullptr),
+    next(nullptr) {
+}
+
+Timer::~Timer() {
+}
+
+string Timer::repr() const {
+    if (this->deferred == nullptr) {
+        return "Timer(handler=null)";
+
+    } else if (this->trigger_at_time == 0) {
+        return K273::fmtString("Timer0(handler=%s)", this->deferred->repr().c_str());
+
+    } else {
+        return K273::fmtString("Time(handler=%s, trigger_time=%lu)",
+                               this->deferred->repr().c_str(),
+                               this->trigger_at_time);
+    }
+}
+
+void Timer::splice(Timer* other) {
+    if (other->listEmpty()) {
+        return;
+    }
+
+    other->next->prev = this->prev;
+    this->prev->next = other->next;
+    other->prev->next = this;
+    this->prev = other->prev;
+
+    other->initList();
+}
+
+void Timer::unlinkAll() {
+    while (!this->listEmpty()) {
+        this->popFront();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+TimerWheel::TimerWheel(uint64_t now) :
+    current(now) {
+
+    for (int ii=0; ii<LEVEL0_SIZE; ii++) {
+        this->level0[ii].initList();
+    }
+
+    for (int ii=0; ii<LEVEL0_SIZE / 64; ii++) {
+        this->level0_bits[ii] = 0;
+    }
+
+    for (int level=0; level<UPPER_LEVELS; level++) {
+        for (int ii=0; ii<LEVEL_SIZE; ii++) {
+            this->levels[level][ii].initList();
+        }
+
+        this->level_bits[level] = 0;
+    }
+
+    this->expired.initList();
+}
+
+TimerWheel::~TimerWheel() {
+    // Deferreds may outlive us, make sure they don't point into our slots
+    for (int ii=0; ii<LEVEL0_SIZE; ii++) {
+        this->level0[ii].unlinkAll();
+    }
+
+    for (int level=0; level<UPPER_LEVELS; level++) {
+        for (int ii=0; ii<LEVEL_SIZE; ii++) {
+            this->levels[level][ii].unlinkAll();
+        }
+    }
+
+    this->expired.unlinkAll();
+}
+
+void TimerWheel::add(Timer* timer, uint64_t trigger_at_time) {
+    ASSERT (!timer->scheduled());
+
+    timer->trigger_at_time = trigger_at_time;
+
+    uint64_t when = std::max(trigger_at_time, this->current);
+    uint64_t delta = when - this->current;
+
+    if (delta < LEVEL0_SIZE) {
+        const int index = when & (LEVEL0_SIZE - 1);
+        this->level0[index].pushBack(timer);
+        this->level0_bits[index / 64] |= uint64_t(1) << (index % 64);
+        return;
+    }
+
+    // beyond the top level, park in the furthest slot and it will be recascaded
+    const uint64_t max_delta = (uint64_t(1) << TOTAL_BITS) - 1;
+    if (delta > max_delta) {
+        when = this->current + max_delta;
+        delta = max_delta;
+    }
+
+    int level = 0;
+    while ((delta >> (LEVEL0_BITS + (level + 1) * LEVEL_BITS)) != 0) {
+        level++;
+    }
+
+    const int shift = LEVEL0_BITS + level * LEVEL_BITS;
+    const int index = (when >> shift) & (LEVEL_SIZE - 1);
+    this->levels[level][index].pushBack(timer);
+    this->level_bits[level] |= uint64_t(1) << index;
+}
+
+void TimerWheel::cascade(int level) {
+    const int shift = LEVEL0_BITS + level * LEVEL_BITS;
+    const int index = (this->current >> shift) & (LEVEL_SIZE - 1);
+
+    this->level_bits[level] &= ~(uint64_t(1) << index);
+
+    // take the whole slot first, as re-adding might put timers back in the same slot (parked)
+    Timer pending;
+    pending.initList();
+    pending.splice(&this->levels[level][index]);
+
+    while (!pending.listEmpty()) {
+        Timer* timer = pending.popFront();
+        this->add(timer, timer->trigger_at_time);
+    }
+}
+
+void TimerWheel::advance(uint64_t now) {
+    while (this->current <= now) {
+        // nothing on level 0, jump straight to the next cascade that will do something
+        if ((this->level0_bits[0] | this->level0_bits[1] |
+             this->level0_bits[2] | this->level0_bits[3]) == 0) {
+            this->current = std::min(this->nextUpperTime(), now + 1);
+            if (this->current > now) {
+                break;
+            }
+        }
+
+        const int index = this->current & (LEVEL0_SIZE - 1);
+
+        if (index == 0) {
+            for (int level=0; level<UPPER_LEVELS; level++) {
+                this->cascade(level);
+
+                // only cascade the level above when this one has wrapped around
+                const int shift = LEVEL0_BITS + level * LEVEL_BITS;
+                if (((this->current >> shift) & (LEVEL_SIZE - 1)) != 0) {
+                    break;
+                }
+            }
+        }
+
+        uint64_t& bits = this->level0_bits[index / 64];
+        const uint64_t bit = uint64_t(1) << (index % 64);
+        if (bits & bit) {
+            this->expired.splice(&this->level0[index]);
+            bits &= ~bit;
+        }
+
+        // skip over empty slots, up to the next cascade
+        int next_index = -1;
+        for (int word=index / 64, from=(index % 64) + 1; word<LEVEL0_SIZE / 64; word++, from=0) {
+            int found = nextSetBit(this->level0_bits[word], from);
+            if (found >= 0) {
+                next_index = word * 64 + found;
+                break;
+            }
+        }
+
+        uint64_t next_tick;
+        if (next_index >= 0) {
+            next_tick = this->current + (next_index - index);
+        } else {
+            next_tick = (this->current | (LEVEL0_SIZE - 1)) + 1;
+        }
+
+        this->current = std::min(next_tick, now + 1);
+    }
+}
+
+uint64_t TimerWheel::upperSlotTime(int level, int index) const {
+    // the time the slot is cascaded
+    const int shift = LEVEL0_BITS + level * LEVEL_BITS;
+    const int current_index = (this->current >> shift) & (LEVEL_SIZE - 1);
+
+    uint64_t distance = (index - current_index) & (LEVEL_SIZE - 1);
+    if (distance == 0) {
+        // exactly on the boundary, the cascade is the next tick processed.  Otherwise all the
+        // way round.
+        const uint64_t mask = (uint64_t(1) << shift) - 1;
+        if ((this->current & mask) == 0) {
+            return this->current;
+        }
+
+        distance = LEVEL_SIZE;
+    }
+
+    return ((this->current >> shift) + distance) << shift;
+}
+
+uint64_t TimerWheel::nextUpperTime() {
+    uint64_t best = std::numeric_limits <uint64_t>::max();
+
+    for (int level=0; level<UPPER_LEVELS; level++) {
+        uint64_t bits = this->level_bits[level];
+        while (bits) {
+            const int index = __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            // bits may be stale after cancels
+            if (this->levels[level][index].listEmpty()) {
+                this->level_bits[level] &= ~(uint64_t(1) << index);
+                continue;
+            }
+
+            best = std::min(best, this->upperSlotTime(level, index));
+        }
+    }
+
+    return best;
+}
+
+int TimerWheel::nextTimeout(uint64_t now) {
+    if (!this->expired.listEmpty()) {
+        return 0;
+    }
+
+    uint64_t best = std::numeric_limits <uint64_t>::max();
+    const int current_index = this->current & (LEVEL0_SIZE - 1);
+
+    // level 0, searching circularly from the current slot.  Bits may be stale after cancels,
+    // clear them as we go.
+    for (int pass=0; pass<2; pass++) {
+        const int from = pass == 0 ? current_index : 0;
+        const int to = pass == 0 ? LEVEL0_SIZE : current_index;
+
+        for (int word=from / 64; word * 64 < to; word++) {
+            int bit = (word == from / 64) ? from % 64 : 0;
+            while ((bit = nextSetBit(this->level0_bits[word], bit)) >= 0) {
+                const int index = word * 64 + bit;
+                if (index >= to) {
+                    break;
+                }
+
+                if (this->level0[index].listEmpty()) {
+                    this->level0_bits[word] &= ~(uint64_t(1) << bit);
+                    bit++;
+                    continue;
+                }
+
+                if (pass == 0) {
+                    best = this->current + (index - current_index);
+                } else {
+                    best = this->current + (LEVEL0_SIZE - current_index) + index;
+                }
+
+                break;
+            }
+
+            if (best != std::numeric_limits <uint64_t>::max()) {
+                break;
+            }
+        }
+
+        if (best != std::numeric_limits <uint64_t>::max()) {
+            break;
+        }
+    }
+
+    // this side of the wrap beats all cascades - unless we are sitting on a boundary, with its
+    // cascade still to do
+    const bool before_cascades = (best < ((this->current | (LEVEL0_SIZE - 1)) + 1) &&
+                                  current_index != 0);
+    if (!before_cascades) {
+        best = std::min(best, this->nextUpperTime());
+    }
+
+    if (best == std::numeric_limits <uint64_t>::max()) {
+        return -1;
+    }
+
+    return best > now ? std::min(best - now, (uint64_t) std::numeric_limits <int>::max()) : 0;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+// std includes
+#include <string>
+#include <cstdint>
+
+namespace Kelvin {
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Forwards
+
+    class Deferred;
+    class Scheduler;
+    class TimerWheel;
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Timers are used internally within the scheduler to callback a Deferred object.  It is
+    /// mainly an implementation detail, and not a public class.
+    ///
+    /// Each Deferred embeds its own Timer, so scheduling never allocates.  A Timer is an
+    /// intrusive doubly linked list node - it is either in a timer wheel slot, the scheduler's
+    /// call_laters list, or not linked at all (not scheduled).
+    class Timer {
+    public:
+        Timer(Deferred* deferred=nullptr, unsigned int priority=0);
+        ~Timer();
+
+    public:
+        bool scheduled() const {
+            return this->next != nullptr;
+        }
+
+        /// O(1) removal from whichever list it is in.  Does nothing if not scheduled.
+        void cancel() {
+            if (this->next != nullptr) {
+                this->prev->next = this->next;
+                this->next->prev = this->prev;
+                this->prev = this->next = nullptr;
+            }
+        }
+
+        std::string repr() const;
+
+    private:
+        // a Timer is also used as the sentinel of a circular list
+        void initList() {
+            this->prev = this->next = this;
+        }
+
+        bool listEmpty() const {
+            return this->next == this;
+        }
+
+        void insertBefore(Timer* timer) {
+            timer->next = this;
+            timer->prev = this->prev;
+            this->prev->next = timer;
+            this->prev = timer;
+        }
+
+        void pushBack(Timer* timer) {
+            this->insertBefore(timer);
+        }
+
+        Timer* popFront() {
+            Timer* timer = this->next;
+            timer->cancel();
+            return timer;
+        }
+
+        // moves all of other's timers onto the end of this list, leaving other empty
+        void splice(Timer* other);
+
+        // unlinks everything, so no one holds pointers into this list
+        void unlinkAll();
+
+    private:
+        /// the deferred associated with this Timer (null for list sentinels)
+        Deferred* deferred;
+
+        /// priority for callLater(0)s
+        const unsigned int priority;
+
+        /// time to trigger at (for callLater non zeros)
+        uint64_t trigger_at_time;
+
+        Timer* prev;
+        Timer* next;
+
+    private:
+        friend class Scheduler;
+        friend class TimerWheel;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+
+    /// Hashed hierarchical timing wheel, 1 msec ticks.  Insert and cancel are O(1).  Level 0
+    /// has 256 slots (one per msec), and each of the 4 levels above 64 slots covering 64 times
+    /// the span of the level below (up to ~50 days).  Timers on the upper levels are cascaded
+    /// down as the wheel turns.  Bitmaps of non empty slots let the wheel skip idle time and find
+    /// the next expiry without walking slots.
+
+    class TimerWheel {
+    private:
+        static constexpr int LEVEL0_BITS = 8;
+        static constexpr int LEVEL0_SIZE = 1 << LEVEL0_BITS;
+        static constexpr int LEVEL_BITS = 6;
+        static constexpr int LEVEL_SIZE = 1 << LEVEL_BITS;
+        static constexpr int UPPER_LEVELS = 4;
+        static constexpr int TOTAL_BITS = LEVEL0_BITS + UPPER_LEVELS * LEVEL_BITS;
+
+    public:
+        TimerWheel(uint64_t now);
+        ~TimerWheel();
+
+    public:
+        /// timer must not be scheduled.  Times before the current tick fire on the next advance().
+        void add(Timer* timer, uint64_t trigger_at_time);
+
+        /// moves everything due at or before now onto the expired list
+        void advance(uint64_t now);
+
+        /// next expired timer (unlinked), or nullptr
+        Timer* popExpired() {
+            if (this->expired.listEmpty()) {
+                return nullptr;
+            }
+
+            return this->expired.popFront();
+        }
+
+        /// msecs from now until the wheel next needs advancing (ie the next expiry, or a
+        /// cascade that may produce one).  -1 if there are no timers.
+        int nextTimeout(uint64_t now);
+
+    private:
+        void cascade(int level);
+        uint64_t upperSlotTime(int level, int index) const;
+
+        // earliest cascade of a non empty upper slot, max uint64_t if none
+        uint64_t nextUpperTime();
+
+        static int nextSetBit(uint64_t bits, int from) {
+            bits &= (from < 64) ? (~uint64_t(0) << from) : 0;
+            return bits ? __builtin_ctzll(bits) : -1;
+        }
+
+    private:
+        // next tick to process
+        uint64_t current;
+
+        Timer level0[LEVEL0_SIZE];
+        uint64_t level0_bits[LEVEL0_SIZE / 64];
+
+        Timer levels[UPPER_LEVELS][LEVEL_SIZE];
+        uint64_t level_bits[UPPER_LEVELS];
+
+        // due, not yet called back
+        Timer expired;
+    };
+
+}
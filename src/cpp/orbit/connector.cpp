@@ -14,7 +14,7 @@ using namespace K273::Orbit;
 ///////////////////////////////////////////////////////////////////////////////
 
 Connector::Connector(Streamer::ConnectorBase* connector, int orbit_client_id) :
-    ConnectingProtocol(connector),
+    FramingProtocol(connector),
     is_connected(false),
     orbit_client_id(orbit_client_id),
     initialiser(this->scheduler, this) {
@@ -23,22 +23,8 @@ Connector::Connector(Streamer::ConnectorBase* connector, int orbit_client_id) :
 Connector::~Connector() {
 }
 
-void Connector::onBuffer(ByteBuffer& buf) {
-
-    // have we read enough for a message header?
-    while ((unsigned) buf.remaining() > sizeof(Connection::MessageHeader)) {
-
-        // get header
-        Connection::MessageHeader* header = reinterpret_cast <Connection::MessageHeader*> (buf.getInternalBuf());
-
-        // entire message recieved?
-        if ((unsigned) buf.remaining() >= header->message_length) {
-            this->onMessage(header);
-            buf.skip(header->message_length);
-        } else {
-            break;
-        }
-    }
+void Connector::onFrame(char* data, int size) {
+    this->onMessage(reinterpret_cast <Connection::MessageHeader*> (data));
 }
 
 void Connector::onMessage(Connection::MessageHeader* header) {
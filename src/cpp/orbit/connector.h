@@ -4,6 +4,7 @@
 #include "orbit/msgs.h"
 
 // kelvin includes
+#include <kelvin/framing.h>
 #include <kelvin/streamer.h>
 #include <kelvin/bytebuffer.h>
 #include <kelvin/streamer_client.h>
@@ -12,14 +13,18 @@
 
 namespace K273::Orbit {
 
-    class Connector : public Kelvin::Streamer::ConnectingProtocol {
+    using MessageFraming = Kelvin::Streamer::LengthField <Connection::MessageHeader,
+                                                          &Connection::MessageHeader::message_length>;
+
+    class Connector : public Kelvin::Streamer::FramingProtocol <MessageFraming,
+                                                                Kelvin::Streamer::ConnectingProtocol> {
 
     public:
         Connector(Kelvin::Streamer::ConnectorBase*, int orbit_client_id);
         virtual ~Connector();
 
     public:
-        virtual void onBuffer(Kelvin::ByteBuffer&);
+        virtual void onFrame(char* data, int size);
 
         void onMessage(Connection::MessageHeader*);
         void handleInitialiseClient(Connection::InitialiseClientMessage*);
@@ -91,6 +91,10 @@ namespace K273::Orbit::Connection {
         uint32_t originate_epoch;
         uint32_t originate_nanonsecs;
 
+        // one bit per message_type_id (modulo 64) of the messages in this bundle, so that a
+        // consumer can skip the bundle without touching the payload (see subscription.h)
+        uint64_t type_summary;
+
         uint8_t data[0];
 
     } PACKED;
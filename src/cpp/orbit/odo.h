@@ -2,11 +2,14 @@
 
 // k273 includes
 #include <k273/util.h>
+#include <k273/strutils.h>
+#include <k273/exception.h>
 
 // standard includes
 #include <cstdint>
 #include <string>
 #include <cstring>
+#include <string_view>
 
 namespace K273::Orbit::Odo {
 
@@ -170,40 +173,66 @@ namespace K273::Orbit::Odo {
 
     } PACKED;
 
+    // If the top bit of len is set, the sequence was built with an offset table (see
+    // VariableSequenceBuilder::reset()).  The layout is then:
+    //
+    //   len | table offset | elements ... | offset[0] ... offset[len - 1]
+    //
+    // where all offsets are relative to data.  Otherwise it is just len | elements ...
+
+    const uint32_t VARIABLE_SEQUENCE_INDEXED = 0x80000000;
+
     template <typename T> struct VariableSequence {
     public:
 
         typedef VariableIter<T> Iter;
 
         size_t size() const {
-            return this->len;
+            return this->len & ~VARIABLE_SEQUENCE_INDEXED;
         }
 
-        // this is O(n)
+        bool isIndexed() const {
+            return (this->len & VARIABLE_SEQUENCE_INDEXED) != 0;
+        }
+
+        // this is O(1) if indexed, otherwise O(n)
         const T* index(size_t index) const {
             // if more than index... boom
-            if (index > this->size()) {
+            if (index >= this->size()) {
                 return nullptr;
             }
 
-            // we jump spin through i times
-            const uint8_t* pt_data = this->data;
-            for (size_t ii=0; ii<index; ii++) {
-                const uint32_t* skip_bytes = reinterpret_cast <const uint32_t*> (pt_data);
-                pt_data += *skip_bytes;
+            const uint8_t* pt_data;
+            if (this->isIndexed()) {
+                const uint32_t* table_offset = reinterpret_cast <const uint32_t*> (this->data);
+                const uint32_t* table = reinterpret_cast <const uint32_t*> (this->data + *table_offset);
+                pt_data = this->data + table[index];
+
+            } else {
+                // we jump spin through i times
+                pt_data = this->data;
+                for (size_t ii=0; ii<index; ii++) {
+                    const uint32_t* skip_bytes = reinterpret_cast <const uint32_t*> (pt_data);
+                    pt_data += *skip_bytes;
+                }
             }
 
             return reinterpret_cast <const T*> (pt_data + sizeof(uint32_t));
         }
 
         Iter begin() const {
-            return Iter(0, this->data);
+            return Iter(0, this->elements());
         }
 
         Iter end() const {
             return Iter(this->size(), nullptr);
         }
 
+    private:
+        const uint8_t* elements() const {
+            return this->isIndexed() ? this->data + sizeof(uint32_t) : this->data;
+        }
+
     private:
         uint32_t len;
         uint8_t data[0];
@@ -213,6 +242,39 @@ namespace K273::Orbit::Odo {
     ///////////////////////////////////////////////////////////////////////////////
     // builder helpers:
 
+    // Builders are handed memory and a capacity (typically from a queue reservation).  Each
+    // append is a single compare against the end of that memory, throwing BuilderOverflow rather
+    // than scribbling over whatever follows.  Without a capacity, there are no bounds.
+
+    const size_t UNBOUNDED = SIZE_MAX;
+
+    class BuilderOverflow : public K273::Exception {
+    public:
+        BuilderOverflow(size_t wanted, size_t remaining) :
+            K273::Exception(K273::fmtString("BuilderOverflow : wanted %zu bytes, remaining %zu",
+                                            wanted, remaining)) {
+        }
+
+        virtual ~BuilderOverflow() {
+        }
+    };
+
+    inline uint8_t* memoryEnd(uint8_t* memory, size_t capacity) {
+        // saturate rather than wrap, so UNBOUNDED is always in bounds
+        const uintptr_t start = reinterpret_cast <uintptr_t> (memory);
+        if (capacity >= UINTPTR_MAX - start) {
+            return reinterpret_cast <uint8_t*> (UINTPTR_MAX);
+        }
+
+        return memory + capacity;
+    }
+
+    inline void checkCapacity(const uint8_t* next, size_t wanted, const uint8_t* end) {
+        if (unlikely(wanted > static_cast <size_t> (end - next))) {
+            throw BuilderOverflow(wanted, end - next);
+        }
+    }
+
     class StringBuilder {
     public:
         StringBuilder() {
@@ -227,30 +289,41 @@ namespace K273::Orbit::Odo {
             return this->is_set;
         }
 
-        void setMemory(uint8_t* start_memory) {
+        void setMemory(uint8_t* start_memory, size_t capacity=UNBOUNDED) {
             this->memory = start_memory;
+            this->memory_end = memoryEnd(start_memory, capacity);
         }
 
-        uint32_t set(const char* s) {
-            // include terminating NULL
-            const int len = strlen(s);
+        uint32_t set(std::string_view s) {
+            const size_t len = s.size();
+
+            // round up to nearest 4 (including preceding size and terminating NULL)
+            const uint32_t bytes_consumed = (((len + sizeof(int16_t)) / 4) + 1) * 4;
+            checkCapacity(this->memory, bytes_consumed, this->memory_end);
+
+            if (unlikely(len > INT16_MAX)) {
+                throw BuilderOverflow(len, INT16_MAX);
+            }
 
             String* sb = reinterpret_cast <String*> (memory);
             sb->len = len;
-            memcpy(sb->data, s, len + 1);
+            memcpy(sb->data, s.data(), len);
+            sb->data[len] = '\0';
 
             // update internal stuff
             this->is_set = true;
 
-            // round up to nearest 4 (including preceding size)
-            const uint32_t bytes_consumed = (((len + sizeof(int16_t)) / 4) + 1) * 4;
-
             return bytes_consumed;
         }
 
+        uint32_t set(const char* s) {
+            return this->set(std::string_view(s));
+        }
+
     private:
         bool is_set;
         uint8_t* memory;
+        uint8_t* memory_end;
     };
 
     template <typename T> struct PrimitiveSequenceBuilder {
@@ -268,14 +341,24 @@ namespace K273::Orbit::Odo {
             return this->is_set;
         }
 
-        void setMemory(uint8_t* memory) {
+        void setMemory(uint8_t* memory, size_t capacity=UNBOUNDED) {
+            checkCapacity(memory, sizeof(uint32_t), memoryEnd(memory, capacity));
+
             this->memory_start = reinterpret_cast <uint32_t*> (memory);
 
             // size here is 4 bytes, best alignment guess
             this->memory_next = reinterpret_cast <T*> (memory + sizeof(uint32_t));
+
+            // last position a T can be written at, so pushBack() is one compare
+            const uint8_t* end = memoryEnd(memory, capacity);
+            this->memory_last = reinterpret_cast <const T*> (end - sizeof(T));
         }
 
         void pushBack(T value) {
+            if (unlikely(this->memory_next > this->memory_last)) {
+                throw BuilderOverflow(sizeof(T), 0);
+            }
+
             *this->memory_next = value;
             this->memory_next++;
             this->count++;
@@ -296,6 +379,7 @@ namespace K273::Orbit::Odo {
         uint32_t* memory_start;
 
         T* memory_next;
+        const T* memory_last;
     };
 
 
@@ -305,25 +389,36 @@ namespace K273::Orbit::Odo {
         }
 
     public:
-        void reset() {
+        // if indexed, finalise() writes an offset table after the elements so that
+        // VariableSequence::index() is O(1)
+        void reset(bool indexed=false) {
             this->is_set = false;
             this->count = 0;
+            this->indexed = indexed;
 
-            // even if count zero, we need to say so.
+            // even if count zero, we need to say so (and leave room for table offset).
             this->total_size = sizeof(uint32_t);
+            if (indexed) {
+                this->total_size += sizeof(uint32_t);
+            }
         }
 
         bool isSet() const {
             return this->is_set;
         }
 
-        void setMemory(uint8_t* memory) {
+        void setMemory(uint8_t* memory, size_t capacity=UNBOUNDED) {
             this->memory = reinterpret_cast <uint8_t*> (memory);
+            this->memory_end = memoryEnd(memory, capacity);
+            checkCapacity(this->memory, this->total_size, this->memory_end);
         }
 
         T* getNext() {
-            uint8_t* next = this->memory + this->total_size + sizeof(uint32_t);
-            this->builder.reset(next);
+            uint8_t* entry = this->memory + this->total_size;
+            checkCapacity(entry, sizeof(uint32_t), this->memory_end);
+
+            uint8_t* next = entry + sizeof(uint32_t);
+            this->builder.reset(next, this->memory_end - next);
             return &this->builder;
         }
 
@@ -343,16 +438,40 @@ namespace K273::Orbit::Odo {
             uint32_t* set_count = reinterpret_cast <uint32_t*> (this->memory);
             *(set_count) = this->count;
 
+            if (this->indexed) {
+                checkCapacity(this->memory + this->total_size,
+                              this->count * sizeof(uint32_t), this->memory_end);
+
+                // offsets are relative to the sequence's data (ie after the count)
+                uint8_t* data = this->memory + sizeof(uint32_t);
+
+                uint32_t* table_offset = reinterpret_cast <uint32_t*> (data);
+                *table_offset = this->total_size - sizeof(uint32_t);
+
+                // single walk of the skip chain, so the reader never has to
+                uint32_t* table = reinterpret_cast <uint32_t*> (this->memory + this->total_size);
+                uint32_t offset = sizeof(uint32_t);
+                for (int ii=0; ii<this->count; ii++) {
+                    table[ii] = offset;
+                    offset += *reinterpret_cast <const uint32_t*> (data + offset);
+                }
+
+                this->total_size += this->count * sizeof(uint32_t);
+                *(set_count) |= VARIABLE_SEQUENCE_INDEXED;
+            }
+
             return this->total_size;
         }
 
     private:
         bool is_set;
+        bool indexed;
 
         int count;
         uint32_t total_size;
 
         uint8_t* memory;
+        uint8_t* memory_end;
 
         T builder;
     };
@@ -366,13 +485,18 @@ namespace K273::Orbit::Odo {
         }
 
     public:
-        void reset(uint8_t* memory) {
+        // capacity is typically the length passed to the queue's reserveBytes()
+        void reset(uint8_t* memory, size_t capacity=UNBOUNDED) {
+            checkCapacity(memory, HEADER_SIZE, memoryEnd(memory, capacity));
+
             this->memory = memory;
             this->header = reinterpret_cast <MessageHeader*> (memory);
+            this->capacity = capacity;
         }
 
         T* getPayloadBuilder() {
-            this->builder.reset(this->header->data);
+            this->builder.reset(this->header->data,
+                                this->capacity == UNBOUNDED ? UNBOUNDED : this->capacity - HEADER_SIZE);
             return &this->builder;
         }
 
@@ -386,6 +510,7 @@ namespace K273::Orbit::Odo {
     private:
         uint8_t* memory;
         MessageHeader* header;
+        size_t capacity;
         T builder;
     };
 
@@ -0,0 +1,244 @@
+#pragma once
+
+// local includes
+#include "orbit/odo.h"
+
+// k273 includes
+#include <k273/util.h>
+
+// standard includes
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+
+namespace K273::Orbit::Odo {
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // Writes json into a caller supplied buffer, for dumping Odo messages off a debug tap /
+    // journal as json lines.  Never allocates.  If the buffer fills up, writing stops and
+    // overflowed() is set - the caller decides whether to flush and retry.
+    //
+    // odogen.py generates writeJson() for each struct and a dumpJson() per schema on top of this.
+
+    class JsonWriter {
+    public:
+        static constexpr int MAX_DEPTH = 32;
+
+    public:
+        JsonWriter(char* buf, size_t capacity) :
+            buf(buf),
+            capacity(capacity) {
+            this->reset();
+        }
+
+    public:
+        void reset() {
+            this->pos = 0;
+            this->depth = 0;
+            this->first[0] = true;
+            this->after_key = false;
+            this->is_overflowed = false;
+        }
+
+        const char* data() const {
+            return this->buf;
+        }
+
+        size_t size() const {
+            return this->pos;
+        }
+
+        bool overflowed() const {
+            return this->is_overflowed;
+        }
+
+        void beginObject() {
+            this->separator();
+            this->put('{');
+            this->push();
+        }
+
+        void endObject() {
+            this->pop();
+            this->put('}');
+        }
+
+        void beginArray() {
+            this->separator();
+            this->put('[');
+            this->push();
+        }
+
+        void endArray() {
+            this->pop();
+            this->put(']');
+        }
+
+        void key(std::string_view k) {
+            this->separator();
+            this->quoted(k);
+            this->put(':');
+            this->after_key = true;
+        }
+
+        void value(std::string_view s) {
+            this->separator();
+            this->quoted(s);
+        }
+
+        void value(const char* s) {
+            this->value(std::string_view(s));
+        }
+
+        void value(const String& s) {
+            this->value(std::string_view(s.c_str(), s.size()));
+        }
+
+        template <typename T>
+        void value(T v) {
+            static_assert(std::is_arithmetic <T>::value, "JsonWriter::value() needs a number");
+            this->separator();
+
+            if constexpr (std::is_same <T, bool>::value) {
+                this->append(v ? std::string_view("true") : std::string_view("false"));
+
+            } else if constexpr (std::is_integral <T>::value) {
+                // widen so int8_t/uint8_t are written as numbers, not chars
+                typedef typename std::conditional <std::is_signed <T>::value, int64_t, uint64_t>::type Wide;
+                char tmp[24];
+                auto res = std::to_chars(tmp, tmp + sizeof(tmp), static_cast <Wide> (v));
+                this->append(std::string_view(tmp, res.ptr - tmp));
+
+            } else {
+                this->number(static_cast <double> (v));
+            }
+        }
+
+        // ends a json line
+        void newline() {
+            this->put('\n');
+            this->first[0] = true;
+        }
+
+    private:
+        void push() {
+            if (unlikely(this->depth + 1 >= MAX_DEPTH)) {
+                this->is_overflowed = true;
+                return;
+            }
+
+            this->depth++;
+            this->first[this->depth] = true;
+        }
+
+        void pop() {
+            if (likely(this->depth > 0)) {
+                this->depth--;
+            }
+        }
+
+        void separator() {
+            if (this->after_key) {
+                this->after_key = false;
+                return;
+            }
+
+            if (this->first[this->depth]) {
+                this->first[this->depth] = false;
+            } else {
+                this->put(',');
+            }
+        }
+
+        bool ensure(size_t n) {
+            if (unlikely(this->is_overflowed || this->pos + n > this->capacity)) {
+                this->is_overflowed = true;
+                return false;
+            }
+
+            return true;
+        }
+
+        void put(char c) {
+            if (this->ensure(1)) {
+                this->buf[this->pos++] = c;
+            }
+        }
+
+        void append(std::string_view s) {
+            if (this->ensure(s.size())) {
+                std::memcpy(this->buf + this->pos, s.data(), s.size());
+                this->pos += s.size();
+            }
+        }
+
+        void number(double d) {
+            // json has no representation for these
+            if (unlikely(!std::isfinite(d))) {
+                this->append("null");
+                return;
+            }
+
+            char tmp[32];
+#if defined(__cpp_lib_to_chars)
+            auto res = std::to_chars(tmp, tmp + sizeof(tmp), d);
+            this->append(std::string_view(tmp, res.ptr - tmp));
+#else
+            int len = snprintf(tmp, sizeof(tmp), "%.17g", d);
+            this->append(std::string_view(tmp, len));
+#endif
+        }
+
+        void quoted(std::string_view s) {
+            // worst case every byte is \u00XX, but almost never - so do the common case in one go
+            if (!this->ensure(s.size() + 2)) {
+                return;
+            }
+
+            static const char hex[] = "0123456789abcdef";
+
+            this->buf[this->pos++] = '"';
+            for (size_t ii=0; ii<s.size(); ii++) {
+                const unsigned char c = s[ii];
+                if (likely(c >= 0x20 && c != '"' && c != '\\')) {
+                    if (unlikely(this->pos + 1 >= this->capacity)) {
+                        this->is_overflowed = true;
+                        return;
+                    }
+
+                    this->buf[this->pos++] = c;
+                    continue;
+                }
+
+                if (c == '"' || c == '\\') {
+                    const char escaped[2] = {'\\', static_cast <char> (c)};
+                    this->append(std::string_view(escaped, 2));
+                } else {
+                    const char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                    this->append(std::string_view(escaped, 6));
+                }
+
+                if (unlikely(this->is_overflowed)) {
+                    return;
+                }
+            }
+
+            this->put('"');
+        }
+
+    private:
+        char* buf;
+        const size_t capacity;
+        size_t pos;
+
+        int depth;
+        bool first[MAX_DEPTH];
+        bool after_key;
+        bool is_overflowed;
+    };
+
+}
@@ -1,5 +1,7 @@
 #include "orbit/odo.h"
+#include "orbit/odo_json.h"
 #include "orbit/msgs.h"
 #include "orbit/dispatch.h"
 #include "orbit/connector.h"
+#include "orbit/subscription.h"
 #include "orbit/queue_definitions.h"
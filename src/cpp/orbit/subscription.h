@@ -0,0 +1,119 @@
+#pragma once
+
+// local includes
+#include "orbit/msgs.h"
+#include "orbit/odo.h"
+
+// k273 includes
+#include <k273/util.h>
+
+// std includes
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////
+
+namespace K273::Orbit {
+
+    // The bundle type summary is a 64 bit bloom filter of sorts.  A message type sets bit
+    // (message_type_id % 64), so a clear bit means there is definitely no message of that type in
+    // the bundle.
+
+    inline uint64_t typeSummaryBit(uint32_t message_type_id) {
+        return uint64_t(1) << (message_type_id & 63);
+    }
+
+    // producer side, call for each message added to the bundle (type_summary must be zeroed when
+    // the bundle header is initialised).
+    inline void addToTypeSummary(Connection::BundleHeader* bundle, uint32_t message_type_id) {
+        bundle->type_summary |= typeSummaryBit(message_type_id);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    class Subscription {
+    public:
+        Subscription(uint32_t max_message_type_id=256) :
+            bitmap((max_message_type_id / 64) + 1, 0),
+            summary_mask(0) {
+        }
+
+    public:
+        void subscribe(uint32_t message_type_id) {
+            const uint32_t word = message_type_id / 64;
+            if (word >= this->bitmap.size()) {
+                this->bitmap.resize(word + 1, 0);
+            }
+
+            this->bitmap[word] |= typeSummaryBit(message_type_id);
+            this->summary_mask |= typeSummaryBit(message_type_id);
+        }
+
+        void unsubscribe(uint32_t message_type_id) {
+            const uint32_t word = message_type_id / 64;
+            if (word >= this->bitmap.size()) {
+                return;
+            }
+
+            this->bitmap[word] &= ~typeSummaryBit(message_type_id);
+
+            // the summary mask is just all the words of the bitmap or'ed together
+            this->summary_mask = 0;
+            for (uint64_t w : this->bitmap) {
+                this->summary_mask |= w;
+            }
+        }
+
+        void clear() {
+            std::fill(this->bitmap.begin(), this->bitmap.end(), 0);
+            this->summary_mask = 0;
+        }
+
+        bool wants(uint32_t message_type_id) const {
+            const uint32_t word = message_type_id / 64;
+            if (unlikely(word >= this->bitmap.size())) {
+                return false;
+            }
+
+            return (this->bitmap[word] & typeSummaryBit(message_type_id)) != 0;
+        }
+
+        // only looks at the bundle header, so never pulls in the payload cache lines.  May give
+        // false positives (type ids that collide modulo 64), never false negatives.
+        bool wantsBundle(const Connection::BundleHeader* bundle) const {
+            return (bundle->type_summary & this->summary_mask) != 0;
+        }
+
+        // calls f(const Odo::MessageHeader*) for each message in the bundle we are subscribed
+        // to.  Returns the number of messages passed to f.
+        template <typename F>
+        int forEach(const Connection::BundleHeader* bundle, F f) const {
+            if (!this->wantsBundle(bundle)) {
+                return 0;
+            }
+
+            int count = 0;
+            const uint8_t* pt_data = bundle->data;
+            for (int ii=0; ii<bundle->message_count; ii++) {
+                const Odo::MessageHeader* msg = reinterpret_cast <const Odo::MessageHeader*> (pt_data);
+                if (this->wants(msg->message_type_id)) {
+                    f(msg);
+                    count++;
+                }
+
+                pt_data += msg->message_length;
+            }
+
+            return count;
+        }
+
+    private:
+        // one bit per message_type_id
+        std::vector <uint64_t> bitmap;
+
+        // bitmap folded into 64 bits, to test against BundleHeader::type_summary
+        uint64_t summary_mask;
+    };
+
+}
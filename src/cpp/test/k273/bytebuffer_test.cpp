@@ -0,0 +1,296 @@
+// kelvin includes
+#include <kelvin/bytebuffer.h>
+
+// 3rd party
+#include <catch.hpp>
+
+// std includes
+#include <vector>
+#include <limits>
+#include <cstdint>
+
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("tryGet() and peek() on partial input", "[bytebuffer_try]") {
+    ByteBuffer buf(64);
+    buf.putDatatype <uint32_t> (0xdeadbeef);
+    buf.putDatatype <uint8_t> (7);
+    buf.flip();
+
+    // peeking never consumes
+    uint32_t word = 0;
+    REQUIRE(buf.peek(word));
+    REQUIRE(word == 0xdeadbeef);
+    REQUIRE(buf.remaining() == 5);
+
+    uint8_t byte = 0;
+    REQUIRE(buf.peek(byte, 4));
+    REQUIRE(byte == 7);
+    REQUIRE_FALSE(buf.peek(byte, 5));
+    REQUIRE_FALSE(buf.peek(byte, -1));
+
+    REQUIRE(buf.tryGet(word));
+    REQUIRE(word == 0xdeadbeef);
+    REQUIRE(buf.remaining() == 1);
+
+    // not enough, nothing consumed
+    REQUIRE_FALSE(buf.tryGet(word));
+    REQUIRE(buf.remaining() == 1);
+
+    REQUIRE(buf.tryGet(byte));
+    REQUIRE(byte == 7);
+    REQUIRE(buf.remaining() == 0);
+    REQUIRE_FALSE(buf.tryGet(byte));
+}
+
+TEST_CASE("trySkip(), tryRead() and spans", "[bytebuffer_try]") {
+    ByteBuffer buf(64);
+    buf.putString("hello world", 11);
+    buf.flip();
+
+    REQUIRE_FALSE(buf.trySkip(-1));
+    REQUIRE_FALSE(buf.trySkip(12));
+    REQUIRE(buf.remaining() == 11);
+
+    const char* span = buf.peekSpan(5, 6);
+    REQUIRE(span != nullptr);
+    REQUIRE(std::string(span, 5) == "world");
+    REQUIRE(buf.peekSpan(6, 6) == nullptr);
+    REQUIRE(buf.peekSpan(-1) == nullptr);
+    REQUIRE(buf.remaining() == 11);
+
+    span = buf.trySpan(5);
+    REQUIRE(span != nullptr);
+    REQUIRE(std::string(span, 5) == "hello");
+    REQUIRE(buf.trySkip(1));
+
+    char data[8];
+    REQUIRE_FALSE(buf.tryRead(data, 6));
+    REQUIRE(buf.remaining() == 5);
+    REQUIRE(buf.tryRead(data, 5));
+    REQUIRE(std::string(data, 5) == "world");
+
+    REQUIRE(buf.trySpan(1) == nullptr);
+    REQUIRE(buf.trySpan(0) != nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static std::vector <uint64_t> varintValues() {
+    // every length from 1 to 10 bytes, and either side of each boundary
+    std::vector <uint64_t> values = {0, 1, 127, 128, 300, 16383, 16384};
+    for (int bits=14; bits<64; bits+=7) {
+        values.push_back((1ULL << bits) - 1);
+        values.push_back(1ULL << bits);
+    }
+
+    values.push_back(std::numeric_limits <uint64_t>::max());
+    return values;
+}
+
+TEST_CASE("varint round trip, fast and slow paths", "[bytebuffer_varint]") {
+    const std::vector <uint64_t> values = varintValues();
+
+    // repeated so most are decoded with 8+ bytes remaining (the one load path), but the
+    // long ones and the tail go through tryGetVarint()
+    const int repeats = 50;
+    ByteBuffer buf(values.size() * repeats * ByteBuffer::MAX_VARINT_SIZE);
+
+    int total_size = 0;
+    for (int ii=0; ii<repeats; ii++) {
+        for (uint64_t value : values) {
+            buf.putVarint(value);
+            total_size += ByteBuffer::varintSize(value);
+        }
+    }
+
+    buf.flip();
+    REQUIRE(buf.remaining() == total_size);
+
+    std::vector <uint64_t> decoded(values.size() * repeats);
+    REQUIRE(buf.getVarints(decoded.data(), decoded.size()) == (int) decoded.size());
+    REQUIRE(buf.remaining() == 0);
+
+    for (size_t ii=0; ii<decoded.size(); ii++) {
+        REQUIRE(decoded[ii] == values[ii % values.size()]);
+    }
+}
+
+TEST_CASE("varint sizes", "[bytebuffer_varint]") {
+    REQUIRE(ByteBuffer::varintSize(0) == 1);
+    REQUIRE(ByteBuffer::varintSize(127) == 1);
+    REQUIRE(ByteBuffer::varintSize(128) == 2);
+    REQUIRE(ByteBuffer::varintSize(std::numeric_limits <uint64_t>::max()) ==
+            ByteBuffer::MAX_VARINT_SIZE);
+
+    for (uint64_t value : varintValues()) {
+        ByteBuffer buf(ByteBuffer::MAX_VARINT_SIZE);
+        buf.putVarint(value);
+        REQUIRE(buf.remaining() == ByteBuffer::MAX_VARINT_SIZE - ByteBuffer::varintSize(value));
+    }
+}
+
+TEST_CASE("zigzag edge values", "[bytebuffer_varint]") {
+    const int64_t min = std::numeric_limits <int64_t>::min();
+    const int64_t max = std::numeric_limits <int64_t>::max();
+
+    REQUIRE(ByteBuffer::zigzagEncode(0) == 0);
+    REQUIRE(ByteBuffer::zigzagEncode(-1) == 1);
+    REQUIRE(ByteBuffer::zigzagEncode(1) == 2);
+    REQUIRE(ByteBuffer::zigzagEncode(max) == std::numeric_limits <uint64_t>::max() - 1);
+    REQUIRE(ByteBuffer::zigzagEncode(min) == std::numeric_limits <uint64_t>::max());
+
+    const int64_t values[] = {0, -1, 1, -64, 64, min, min + 1, max, max - 1};
+
+    ByteBuffer buf(64 * ByteBuffer::MAX_VARINT_SIZE);
+    for (int64_t value : values) {
+        REQUIRE(ByteBuffer::zigzagDecode(ByteBuffer::zigzagEncode(value)) == value);
+        buf.putSignedVarint(value);
+    }
+
+    buf.flip();
+    for (int64_t value : values) {
+        int64_t decoded = 0;
+        REQUIRE(buf.tryGetSignedVarint(decoded) == VarintStatus::OK);
+        REQUIRE(decoded == value);
+    }
+}
+
+TEST_CASE("incomplete and malformed varints", "[bytebuffer_varint]") {
+    uint64_t value = 0;
+
+    SECTION("incomplete consumes nothing") {
+        // the first 3 bytes of a 6 byte varint
+        ByteBuffer buf(16);
+        for (int ii=0; ii<3; ii++) {
+            buf.putDatatype <uint8_t> (0x80);
+        }
+
+        buf.flip();
+
+        REQUIRE(buf.tryGetVarint(value) == VarintStatus::INCOMPLETE);
+        REQUIRE(buf.remaining() == 3);
+        REQUIRE_THROWS_AS(buf.getVarint(), BufferUnderflow);
+
+        uint64_t values[2];
+        REQUIRE(buf.getVarints(values, 2) == 0);
+    }
+
+    SECTION("10th byte of 1 is bit 63") {
+        ByteBuffer buf(16);
+        for (int ii=0; ii<9; ii++) {
+            buf.putDatatype <uint8_t> (0x80);
+        }
+
+        buf.putDatatype <uint8_t> (0x01);
+        buf.flip();
+
+        REQUIRE(buf.tryGetVarint(value) == VarintStatus::OK);
+        REQUIRE(value == 1ULL << 63);
+    }
+
+    SECTION("10th byte over 1 is malformed") {
+        ByteBuffer buf(16);
+        for (int ii=0; ii<9; ii++) {
+            buf.putDatatype <uint8_t> (0xff);
+        }
+
+        buf.putDatatype <uint8_t> (0x02);
+        buf.flip();
+
+        REQUIRE(buf.tryGetVarint(value) == VarintStatus::MALFORMED);
+        REQUIRE(buf.remaining() == 10);
+        REQUIRE_THROWS_AS(buf.getVarint(), MalformedVarint);
+    }
+
+    SECTION("continuation on the 10th byte is malformed") {
+        ByteBuffer buf(32);
+        for (int ii=0; ii<12; ii++) {
+            buf.putDatatype <uint8_t> (0xff);
+        }
+
+        buf.flip();
+        REQUIRE(buf.tryGetVarint(value) == VarintStatus::MALFORMED);
+
+        uint64_t values[2];
+        REQUIRE_THROWS_AS(buf.getVarints(values, 2), MalformedVarint);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("byte ordered arrays", "[bytebuffer_array]") {
+    const uint32_t words[] = {0x01020304, 0xa0b0c0d0};
+
+    SECTION("little endian layout") {
+        ByteBuffer buf(16);
+        buf.putArrayLE(words, 2);
+        buf.flip();
+
+        const uint8_t expected[] = {0x04, 0x03, 0x02, 0x01, 0xd0, 0xc0, 0xb0, 0xa0};
+        const char* span = buf.peekSpan(8);
+        REQUIRE(span != nullptr);
+        REQUIRE(std::memcmp(span, expected, 8) == 0);
+
+        uint32_t decoded[2];
+        buf.getArrayLE(decoded, 2);
+        REQUIRE(decoded[0] == words[0]);
+        REQUIRE(decoded[1] == words[1]);
+    }
+
+    SECTION("big endian layout") {
+        ByteBuffer buf(16);
+        buf.putArrayBE(words, 2);
+        buf.flip();
+
+        const uint8_t expected[] = {0x01, 0x02, 0x03, 0x04, 0xa0, 0xb0, 0xc0, 0xd0};
+        const char* span = buf.peekSpan(8);
+        REQUIRE(span != nullptr);
+        REQUIRE(std::memcmp(span, expected, 8) == 0);
+
+        uint32_t decoded[2];
+        REQUIRE(buf.tryGetArrayBE(decoded, 2));
+        REQUIRE(decoded[0] == words[0]);
+        REQUIRE(decoded[1] == words[1]);
+    }
+
+    SECTION("doubles round trip both ways") {
+        const double values[] = {1.5, -0.0, 1e300};
+
+        ByteBuffer buf(64);
+        buf.putArrayBE(values, 3);
+        buf.putArrayLE(values, 3);
+        buf.flip();
+
+        double be[3], le[3];
+        buf.getArrayBE(be, 3);
+        buf.getArrayLE(le, 3);
+        REQUIRE(std::memcmp(be, values, sizeof(values)) == 0);
+        REQUIRE(std::memcmp(le, values, sizeof(values)) == 0);
+    }
+
+    SECTION("bad counts") {
+        // big enough that only the buffer is short
+        uint32_t many[8] = {};
+
+        ByteBuffer buf(16);
+        REQUIRE_THROWS_AS(buf.putArrayLE(many, -1), BufferOverflow);
+        REQUIRE_THROWS_AS(buf.putArrayLE(many, 5), BufferOverflow);
+
+        // count * sizeof(T) overflows an int
+        REQUIRE_THROWS_AS(buf.putArrayLE(many, 0x40000001), BufferOverflow);
+        REQUIRE(buf.remaining() == 16);
+
+        buf.putArrayLE(words, 2);
+        buf.flip();
+
+        uint32_t decoded[8];
+        REQUIRE_FALSE(buf.tryGetArrayLE(decoded, -1));
+        REQUIRE_FALSE(buf.tryGetArrayLE(decoded, 3));
+        REQUIRE_FALSE(buf.tryGetArrayLE(decoded, 0x40000001));
+        REQUIRE(buf.remaining() == 8);
+        REQUIRE_THROWS_AS(buf.getArrayBE(decoded, 3), BufferUnderflow);
+    }
+}
@@ -0,0 +1,218 @@
+// kelvin includes
+#include <kelvin/framing.h>
+#include <kelvin/bytebuffer.h>
+
+// 3rd party
+#include <catch.hpp>
+
+// std includes
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace Kelvin;
+using namespace Kelvin::Streamer;
+
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+    struct Header {
+        uint16_t type;
+        uint32_t length;
+    } __attribute__((packed));
+
+    // length counts the header
+    using Framing = LengthField <Header, &Header::length>;
+
+    // stands in for ChildProtocol, FramingProtocol only needs these
+    class FakeBase {
+    public:
+        FakeBase(int max_input) :
+            max_input(max_input),
+            connected(true) {
+        }
+
+        virtual ~FakeBase() {
+        }
+
+        bool isConnected() {
+            return this->connected;
+        }
+
+        void disconnect() {
+            this->connected = false;
+        }
+
+        int getMaxInput() const {
+            return this->max_input;
+        }
+
+        virtual std::string repr() const {
+            return "FakeBase";
+        }
+
+    private:
+        int max_input;
+        bool connected;
+    };
+
+    class Collector : public FramingProtocol <Framing, FakeBase> {
+    public:
+        Collector(int max_input, bool batched, bool disconnect_on_bad) :
+            FramingProtocol(max_input),
+            batches(0),
+            disconnect_on_bad(disconnect_on_bad) {
+            this->setBatched(batched);
+        }
+
+    public:
+        virtual void onFrame(char* data, int size) {
+            Header header;
+            std::memcpy(&header, data, sizeof(Header));
+            REQUIRE((int) header.length == size);
+
+            this->types.push_back(header.type);
+            this->payloads.emplace_back(data + sizeof(Header), size - sizeof(Header));
+        }
+
+        virtual void onFrames(const FrameView* frames, int count) {
+            this->batches++;
+            FramingProtocol::onFrames(frames, count);
+        }
+
+        virtual void onBadFrame(uint64_t length) {
+            this->bad_lengths.push_back(length);
+            if (this->disconnect_on_bad) {
+                this->disconnect();
+            }
+        }
+
+    public:
+        std::vector <int> types;
+        std::vector <std::string> payloads;
+        std::vector <uint64_t> bad_lengths;
+        int batches;
+
+    private:
+        bool disconnect_on_bad;
+    };
+
+    void putFrame(ByteBuffer& buf, uint16_t type, const std::string& payload) {
+        Header header{type, (uint32_t) (sizeof(Header) + payload.size())};
+        buf.write((const char*) &header, sizeof(Header));
+        buf.write(payload.data(), payload.size());
+    }
+
+    // as the default StreamProtocol::dataReceived() would
+    void deliver(Collector& protocol, ByteBuffer& buf) {
+        buf.flip();
+        protocol.onBuffer(buf);
+        buf.compact();
+    }
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("partial frames wait for the rest", "[framing]") {
+    for (bool batched : {false, true}) {
+        Collector protocol(4096, batched, true);
+
+        ByteBuffer whole(256);
+        putFrame(whole, 1, "first");
+        putFrame(whole, 2, "second frame");
+        putFrame(whole, 3, "");
+        whole.flip();
+
+        // a byte at a time, so every split of header and payload is seen
+        ByteBuffer input(256);
+        while (whole.remaining() > 0) {
+            input.putDatatype <uint8_t> (whole.getDatatype <uint8_t> ());
+            deliver(protocol, input);
+        }
+
+        REQUIRE(protocol.types == std::vector <int> {1, 2, 3});
+        REQUIRE(protocol.payloads[1] == "second frame");
+        REQUIRE(protocol.payloads[2].empty());
+
+        // everything consumed
+        input.flip();
+        REQUIRE(input.remaining() == 0);
+    }
+}
+
+TEST_CASE("batched frames are delivered in one call", "[framing]") {
+    Collector protocol(4096, true, true);
+
+    ByteBuffer input(256);
+    putFrame(input, 1, "a");
+    putFrame(input, 2, "bb");
+    putFrame(input, 3, "ccc");
+
+    // and the start of the next
+    Header next{4, sizeof(Header) + 4};
+    input.write((const char*) &next, sizeof(Header));
+    input.write("dd", 2);
+
+    deliver(protocol, input);
+    REQUIRE(protocol.batches == 1);
+    REQUIRE(protocol.types == std::vector <int> {1, 2, 3});
+
+    input.write("dd", 2);
+    deliver(protocol, input);
+    REQUIRE(protocol.batches == 2);
+    REQUIRE(protocol.types == std::vector <int> {1, 2, 3, 4});
+    REQUIRE(protocol.payloads[3] == "dddd");
+}
+
+TEST_CASE("bad frame lengths", "[framing]") {
+    const bool batched = GENERATE(false, true);
+
+    SECTION("frames before a bad length are delivered") {
+        // the override doesn't disconnect, nothing is lost
+        Collector protocol(4096, batched, false);
+
+        ByteBuffer input(256);
+        putFrame(input, 1, "good");
+        putFrame(input, 2, "also good");
+
+        // shorter than the header
+        Header bad{9, 2};
+        input.write((const char*) &bad, sizeof(Header));
+
+        deliver(protocol, input);
+        REQUIRE(protocol.types == std::vector <int> {1, 2});
+        REQUIRE(protocol.bad_lengths == std::vector <uint64_t> {2});
+        REQUIRE(protocol.isConnected());
+    }
+
+    SECTION("longer than the input can hold") {
+        // max frame length is larger, the input limit wins
+        Collector protocol(64, batched, true);
+        protocol.setMaxFrameLength(1024);
+
+        ByteBuffer input(256);
+        putFrame(input, 1, "fits");
+        Header big{2, 65};
+        input.write((const char*) &big, sizeof(Header));
+
+        deliver(protocol, input);
+        REQUIRE(protocol.types == std::vector <int> {1});
+        REQUIRE(protocol.bad_lengths == std::vector <uint64_t> {65});
+        REQUIRE_FALSE(protocol.isConnected());
+    }
+
+    SECTION("longer than max frame length") {
+        Collector protocol(4096, batched, true);
+        protocol.setMaxFrameLength(100);
+
+        ByteBuffer input(256);
+        Header big{1, 101};
+        input.write((const char*) &big, sizeof(Header));
+
+        deliver(protocol, input);
+        REQUIRE(protocol.types.empty());
+        REQUIRE(protocol.bad_lengths == std::vector <uint64_t> {101});
+    }
+}
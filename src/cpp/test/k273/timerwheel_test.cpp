@@ -0,0 +1,178 @@
+// kelvin includes
+#include <kelvin/timerwheel.h>
+
+// 3rd party
+#include <catch.hpp>
+
+// std includes
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+    // timers and when they are expected to fire
+    struct Expected {
+        Expected(int count) :
+            timers(new Timer[count]),
+            cancelled(count, false) {
+        }
+
+        std::unique_ptr <Timer[]> timers;
+        std::map <Timer*, uint64_t> trigger_at;
+        std::vector <bool> cancelled;
+    };
+
+    // pops everything expired, returning the timers fired
+    std::vector <Timer*> popAll(TimerWheel& wheel) {
+        std::vector <Timer*> fired;
+        while (Timer* timer = wheel.popExpired()) {
+            REQUIRE_FALSE(timer->scheduled());
+            fired.push_back(timer);
+        }
+
+        return fired;
+    }
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("timers fire exactly on time across all levels", "[timerwheel]") {
+    const uint64_t start = 1000000;
+
+    // level 0 edges, each upper level's edges, and beyond the top (parked and recascaded)
+    const std::vector <uint64_t> deltas = {
+        0, 1, 2, 255, 256, 257, 511, 16383, 16384, 16385, 1 << 20, (1 << 20) + 1,
+        (1ULL << 26) + 5, (1ULL << 32) - 1, (1ULL << 32) + 7, 1ULL << 36
+    };
+
+    Expected expected(deltas.size());
+    TimerWheel wheel(start);
+
+    for (size_t ii=0; ii<deltas.size(); ii++) {
+        Timer* timer = &expected.timers[ii];
+        wheel.add(timer, start + deltas[ii]);
+        expected.trigger_at[timer] = start + deltas[ii];
+        REQUIRE(timer->scheduled());
+    }
+
+    // step by nextTimeout(), so every timer must fire on its exact tick
+    uint64_t now = start;
+    size_t fired_count = 0;
+    int steps = 0;
+    while (true) {
+        wheel.advance(now);
+        for (Timer* timer : popAll(wheel)) {
+            REQUIRE(expected.trigger_at[timer] == now);
+            fired_count++;
+        }
+
+        const int timeout = wheel.nextTimeout(now);
+        if (timeout < 0) {
+            break;
+        }
+
+        // never sleeps past a cascade or an expiry, and makes progress
+        REQUIRE(timeout > 0);
+        now += timeout;
+
+        // each cascade is a step, so this stays small despite the range covered
+        REQUIRE(++steps < 10000);
+    }
+
+    REQUIRE(fired_count == deltas.size());
+}
+
+TEST_CASE("timers added in the past fire on the next advance", "[timerwheel]") {
+    Expected expected(2);
+    TimerWheel wheel(5000);
+    wheel.advance(6000);
+
+    wheel.add(&expected.timers[0], 10);
+    wheel.add(&expected.timers[1], 6000);
+    REQUIRE(wheel.nextTimeout(6001) == 0);
+
+    wheel.advance(6001);
+    REQUIRE(popAll(wheel).size() == 2);
+    REQUIRE(wheel.nextTimeout(6001) == -1);
+}
+
+TEST_CASE("cancel before and after cascades", "[timerwheel]") {
+    const int count = 5000;
+    const uint64_t start = 123456789;
+
+    Expected expected(count);
+    TimerWheel wheel(start);
+
+    std::mt19937_64 rng(42);
+    for (int ii=0; ii<count; ii++) {
+        // spread over level 0 and the first two upper levels
+        const uint64_t delta = rng() % (1ULL << 22);
+        wheel.add(&expected.timers[ii], start + delta);
+        expected.trigger_at[&expected.timers[ii]] = start + delta;
+    }
+
+    // a third are cancelled, at random points before they are due (so many after being
+    // cascaded)
+    std::vector <std::pair <uint64_t, int>> cancels;
+    for (int ii=0; ii<count; ii+=3) {
+        const uint64_t trigger_at = expected.trigger_at[&expected.timers[ii]];
+        if (trigger_at > start) {
+            cancels.emplace_back(start + rng() % (trigger_at - start), ii);
+        }
+    }
+
+    std::sort(cancels.begin(), cancels.end());
+
+    uint64_t now = start;
+    size_t next_cancel = 0;
+    int fired_count = 0;
+
+    while (true) {
+        // random sized steps, sometimes across many cascades at once
+        const uint64_t step = 1 + rng() % ((rng() % 8) == 0 ? 100000 : 3000);
+        const uint64_t previous = now;
+        now += step;
+
+        // cancels due before this advance
+        while (next_cancel < cancels.size() && cancels[next_cancel].first < now) {
+            Timer* timer = &expected.timers[cancels[next_cancel].second];
+            REQUIRE(timer->scheduled());
+            timer->cancel();
+            REQUIRE_FALSE(timer->scheduled());
+
+            // cancelling twice does nothing
+            timer->cancel();
+
+            expected.cancelled[cancels[next_cancel].second] = true;
+            next_cancel++;
+        }
+
+        wheel.advance(now);
+        for (Timer* timer : popAll(wheel)) {
+            const int index = timer - expected.timers.get();
+            REQUIRE_FALSE(expected.cancelled[index]);
+
+            // due in this step, not before or after
+            const uint64_t trigger_at = expected.trigger_at[timer];
+            REQUIRE(trigger_at > previous);
+            REQUIRE(trigger_at <= now);
+            fired_count++;
+        }
+
+        if (wheel.nextTimeout(now) < 0) {
+            break;
+        }
+    }
+
+    REQUIRE(next_cancel == cancels.size());
+    REQUIRE(fired_count == count - (int) cancels.size());
+}
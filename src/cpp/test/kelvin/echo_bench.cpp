@@ -0,0 +1,227 @@
+// kelvin includes
+#include <kelvin/reactors.h>
+#include <kelvin/scheduler.h>
+#include <kelvin/streamer_server.h>
+#include <kelvin/streamer_client.h>
+
+// k273 includes
+#include <k273/util.h>
+#include <k273/logging.h>
+#include <k273/strutils.h>
+#include <k273/exception.h>
+
+// std includes
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstring>
+
+///////////////////////////////////////////////////////////////////////////////
+// Echo server throughput over N reactors (N server reactors listening on the same port with
+// SO_REUSEPORT, and N client reactors).  Each client connection ping pongs a small message.
+//
+// usage: echo_bench.bin [seconds] [number_reactors ...]
+
+using namespace std;
+using namespace K273;
+using namespace Kelvin;
+using namespace Kelvin::Streamer;
+
+///////////////////////////////////////////////////////////////////////////////
+
+const int CONNECTIONS_PER_REACTOR = 16;
+const int MESSAGE_SIZE = 64;
+
+///////////////////////////////////////////////////////////////////////////////
+
+class Echo : public ChildProtocol {
+public:
+    Echo(Scheduler* scheduler, Server* server, ConnectedSocket* sock) :
+        ChildProtocol(scheduler, server, sock) {
+    }
+
+    virtual void onBuffer(ByteBuffer& buf) {
+        int size = buf.remaining();
+        this->write(buf.getInternalBuf(), size);
+        buf.skip(size);
+    }
+
+    virtual void connectionMade() {
+    }
+
+    virtual void connectionLost() {
+    }
+
+    virtual std::string repr() const {
+        return "Echo";
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+class PingPong : public ConnectingProtocol {
+public:
+    PingPong(ConnectorBase* connector, std::atomic <long>& total) :
+        ConnectingProtocol(connector),
+        total(total),
+        received(0) {
+        memset(this->msg, 'x', sizeof(this->msg));
+    }
+
+    virtual void onBuffer(ByteBuffer& buf) {
+        this->received += buf.remaining();
+        buf.skip(buf.remaining());
+
+        while (this->received >= MESSAGE_SIZE) {
+            this->received -= MESSAGE_SIZE;
+            this->total.fetch_add(1, std::memory_order_relaxed);
+            this->write(this->msg, MESSAGE_SIZE);
+        }
+    }
+
+    virtual void connectionMade() {
+        this->write(this->msg, MESSAGE_SIZE);
+    }
+
+    virtual void connectionLost() {
+    }
+
+    virtual std::string repr() const {
+        return "PingPong";
+    }
+
+private:
+    std::atomic <long>& total;
+    int received;
+    char msg[MESSAGE_SIZE];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// called back after the Server has started listening (callLater(0)s are FIFO)
+class Listening : public Deferred {
+public:
+    Listening(Scheduler* scheduler, std::atomic <int>& count) :
+        Deferred(scheduler),
+        count(count) {
+    }
+
+    virtual void onWakeup() {
+        this->count++;
+    }
+
+private:
+    std::atomic <int>& count;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void bench(int number_reactors, double seconds) {
+    const int port = 24000 + number_reactors;
+
+    Reactors servers(number_reactors, "epoll", false);
+    vector <std::unique_ptr <Server>> server_instances(number_reactors);
+    vector <std::unique_ptr <Listening>> listeners(number_reactors);
+    std::atomic <int> listening(0);
+
+    auto server_setup = [&](Scheduler* scheduler, int index) {
+        server_instances[index].reset(new Server(tcpConfigHelper <Echo> (scheduler, "127.0.0.1",
+                                                                          port, true)));
+
+        listeners[index].reset(new Listening(scheduler, listening));
+        listeners[index]->callLater(0);
+    };
+
+    auto server_teardown = [&](Scheduler* scheduler, int index) {
+        listeners[index].reset();
+        server_instances[index].reset();
+    };
+
+    std::thread server_thread([&]() {
+            servers.run(server_setup, server_teardown);
+        });
+
+    while (listening.load() < number_reactors) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    Reactors clients(number_reactors, "epoll", false);
+    std::atomic <long> total(0);
+
+    vector <std::unique_ptr <TCPConnector>> connectors(number_reactors * CONNECTIONS_PER_REACTOR);
+    vector <std::unique_ptr <PingPong>> pingers(number_reactors * CONNECTIONS_PER_REACTOR);
+
+    auto client_setup = [&](Scheduler* scheduler, int index) {
+        for (int ii=0; ii<CONNECTIONS_PER_REACTOR; ii++) {
+            const int jj = index * CONNECTIONS_PER_REACTOR + ii;
+            connectors[jj].reset(new TCPConnector(scheduler, "127.0.0.1", port));
+            pingers[jj].reset(new PingPong(connectors[jj].get(), total));
+            pingers[jj]->connect();
+        }
+    };
+
+    auto client_teardown = [&](Scheduler* scheduler, int index) {
+        for (int ii=0; ii<CONNECTIONS_PER_REACTOR; ii++) {
+            const int jj = index * CONNECTIONS_PER_REACTOR + ii;
+            pingers[jj]->disconnect();
+            pingers[jj].reset();
+            connectors[jj].reset();
+        }
+    };
+
+    std::thread timer_thread([&]() {
+            // warm up, then measure
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            long start_total = total.load();
+            double start = get_time();
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(int(seconds * 1000)));
+
+            double rate = (total.load() - start_total) / (get_time() - start);
+            l_info("reactors: %d, connections: %d, echoes/sec: %.0f",
+                   number_reactors, number_reactors * CONNECTIONS_PER_REACTOR, rate);
+
+            clients.shutdown();
+        });
+
+    clients.run(client_setup, client_teardown);
+    timer_thread.join();
+
+    servers.shutdown();
+    server_thread.join();
+}
+
+void go(vector <string>& args) {
+    double seconds = 2.0;
+    if (args.size() > 1) {
+        seconds = toDouble(args[1]);
+    }
+
+    vector <int> sizes;
+    for (size_t ii=2; ii<args.size(); ii++) {
+        sizes.push_back(toInt(args[ii]));
+    }
+
+    if (sizes.empty()) {
+        sizes = {1, 2, 4, 8, 16};
+    }
+
+    l_info("cpus online: %d", (int) std::thread::hardware_concurrency());
+    for (int number_reactors : sizes) {
+        bench(number_reactors, seconds);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#include <k273/runner.h>
+
+int main(int argc, char** argv) {
+    K273::Runner::Config config(argc, argv);
+    config.log_filename = "echo_bench.log";
+
+    return K273::Runner::Main(go, config);
+}
@@ -0,0 +1,277 @@
+// kelvin includes
+#include <kelvin/socket.h>
+#include <kelvin/selector.h>
+#include <kelvin/scheduler.h>
+#include <kelvin/forwarder.h>
+
+// k273 includes
+#include <k273/util.h>
+#include <k273/logging.h>
+#include <k273/strutils.h>
+#include <k273/exception.h>
+
+// std includes
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cerrno>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Relay throughput on loopback: producer -> relay -> consumer, with the relay either splicing
+// (Forwarder) or copying through a user space buffer (recv() then send()).
+//
+// usage: forward_bench.bin [seconds] [pipe_size]
+
+using namespace std;
+using namespace K273;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+const int CHUNK_SIZE = 64 * 1024;
+
+///////////////////////////////////////////////////////////////////////////////
+
+// returns a connected pair of tcp sockets, both blocking
+static pair <int, int> tcpPair() {
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    socklen_t addr_len = sizeof(addr);
+    if (::bind(listener, (struct sockaddr*) &addr, addr_len) != 0 ||
+        ::listen(listener, 1) != 0 ||
+        ::getsockname(listener, (struct sockaddr*) &addr, &addr_len) != 0) {
+        throw SysException("tcpPair() listener", errno);
+    }
+
+    int client = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (::connect(client, (struct sockaddr*) &addr, addr_len) != 0) {
+        throw SysException("tcpPair() connect", errno);
+    }
+
+    int server = ::accept(listener, nullptr, nullptr);
+    ::close(listener);
+    return make_pair(client, server);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+class Done : public Forwarder {
+public:
+    Done(Scheduler* scheduler, ConnectedSocket* a, ConnectedSocket* b, int pipe_size,
+         bool& done) :
+        Forwarder(scheduler, a, b, pipe_size),
+        done(done) {
+    }
+
+    virtual void finished() {
+        this->done = true;
+    }
+
+private:
+    bool& done;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// one direction only (src -> dst), one handler registered for both sockets
+class CopyRelay : public EventHandler {
+public:
+    CopyRelay(Scheduler* scheduler, ConnectedSocket* src, ConnectedSocket* dst, bool& done) :
+        scheduler(scheduler),
+        src(src),
+        dst(dst),
+        buf(new char[CHUNK_SIZE]),
+        start(0),
+        end(0),
+        done(done) {
+    }
+
+    virtual ~CopyRelay() {
+    }
+
+    void go() {
+        this->scheduler->registerHandler(this, this->src->fileno(), OP_READ);
+    }
+
+    virtual void doRead(SelectionKey* key) {
+        int count = this->src->recv(this->buf.get(), CHUNK_SIZE);
+        if (count == 0) {
+            ::shutdown(this->dst->fileno(), SHUT_WR);
+            this->scheduler->registerHandler(this, this->src->fileno(), 0);
+            this->done = true;
+            return;
+        }
+
+        if (count < 0) {
+            return;
+        }
+
+        this->start = 0;
+        this->end = count;
+        if (!this->send()) {
+            // wait for dst, and stop reading until then
+            this->scheduler->registerHandler(this, this->src->fileno(), 0);
+            this->scheduler->registerHandler(this, this->dst->fileno(), OP_WRITE);
+        }
+    }
+
+    virtual void doWrite(SelectionKey* key) {
+        if (this->send()) {
+            this->scheduler->registerHandler(this, this->dst->fileno(), 0);
+            this->scheduler->registerHandler(this, this->src->fileno(), OP_READ);
+        }
+    }
+
+    virtual std::string repr() const {
+        return "CopyRelay";
+    }
+
+private:
+    bool send() {
+        while (this->start < this->end) {
+            int count = this->dst->send(this->buf.get() + this->start, this->end - this->start);
+            if (count < 0) {
+                return false;
+            }
+
+            this->start += count;
+        }
+
+        return true;
+    }
+
+private:
+    Scheduler* scheduler;
+    ConnectedSocket* src;
+    ConnectedSocket* dst;
+
+    std::unique_ptr <char[]> buf;
+    int start;
+    int end;
+
+    bool& done;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+static void bench(bool use_splice, double seconds, int pipe_size) {
+    pair <int, int> in = tcpPair();
+    pair <int, int> out = tcpPair();
+
+    ConnectedSocket relay_in(in.second);
+    ConnectedSocket relay_out(out.first);
+    relay_in.setBlocking(false);
+    relay_out.setBlocking(false);
+
+    std::atomic <bool> stop(false);
+    std::thread producer([&]() {
+            vector <char> chunk(CHUNK_SIZE, 'x');
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (::send(in.first, chunk.data(), chunk.size(), 0) < 0) {
+                    break;
+                }
+            }
+
+            ::shutdown(in.first, SHUT_WR);
+        });
+
+    long received = 0;
+    double elapsed = 0;
+    std::thread consumer([&]() {
+            vector <char> chunk(CHUNK_SIZE);
+            double start = get_time();
+            while (true) {
+                ssize_t count = ::recv(out.second, chunk.data(), chunk.size(), 0);
+                if (count <= 0) {
+                    break;
+                }
+
+                received += count;
+            }
+
+            elapsed = get_time() - start;
+        });
+
+    std::unique_ptr <Selector> selector(Selector::create("epoll"));
+    Scheduler scheduler(selector.get(), false);
+    scheduler.run(true);
+
+    bool done = false;
+    std::unique_ptr <Done> forwarder;
+    std::unique_ptr <CopyRelay> copier;
+
+    if (use_splice) {
+        forwarder.reset(new Done(&scheduler, &relay_in, &relay_out, pipe_size, done));
+        forwarder->start();
+
+    } else {
+        copier.reset(new CopyRelay(&scheduler, &relay_in, &relay_out, done));
+        copier->go();
+    }
+
+    double finish_at = get_time() + seconds;
+    while (!done) {
+        scheduler.poll(10);
+        if (!stop.load() && get_time() > finish_at) {
+            stop = true;
+        }
+
+        // only one direction carries data, close the other so splice mode can finish
+        if (use_splice && stop.load()) {
+            ::shutdown(out.second, SHUT_WR);
+        }
+    }
+
+    producer.join();
+    consumer.join();
+
+    l_info("%s: %.1f MB/s (%ld bytes in %.2fs)", use_splice ? "splice" : "copy  ",
+           received / elapsed / (1024 * 1024), received, elapsed);
+
+    forwarder.reset();
+    copier.reset();
+
+    ::close(in.first);
+    ::close(in.second);
+    ::close(out.first);
+    ::close(out.second);
+}
+
+void go(vector <string>& args) {
+    double seconds = 2.0;
+    if (args.size() > 1) {
+        seconds = toDouble(args[1]);
+    }
+
+    int pipe_size = 256 * 1024;
+    if (args.size() > 2) {
+        pipe_size = toInt(args[2]);
+    }
+
+    for (int ii=0; ii<2; ii++) {
+        bench(false, seconds, pipe_size);
+        bench(true, seconds, pipe_size);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#include <k273/runner.h>
+
+int main(int argc, char** argv) {
+    K273::Runner::Config config(argc, argv);
+    config.log_filename = "forward_bench.log";
+
+    return K273::Runner::Main(go, config);
+}
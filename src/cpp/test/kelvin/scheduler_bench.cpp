@@ -0,0 +1,176 @@
+// kelvin includes
+#include <kelvin/selector.h>
+#include <kelvin/scheduler.h>
+
+// k273 includes
+#include <k273/util.h>
+#include <k273/logging.h>
+#include <k273/strutils.h>
+#include <k273/exception.h>
+
+// std includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+
+///////////////////////////////////////////////////////////////////////////////
+// Cost of Scheduler callLater(0) (enqueue + dispatch, mixed priorities) and of resetting timers
+// (ie read timeouts on lots of connections).  Also of Scheduler::post() from other threads
+// into a running scheduler.
+//
+// usage: scheduler_bench.bin [number_deferreds ...]
+
+using namespace std;
+using namespace K273;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+class Counter : public Deferred {
+public:
+    Counter(Scheduler* scheduler, int priority, int& last_priority, bool& in_order) :
+        Deferred(scheduler, priority),
+        priority(priority),
+        last_priority(last_priority),
+        in_order(in_order) {
+    }
+
+    virtual void onWakeup() {
+        // must be called back highest priority first
+        if (this->priority > this->last_priority) {
+            this->in_order = false;
+        }
+
+        this->last_priority = this->priority;
+    }
+
+    virtual std::string repr() const {
+        return "Counter";
+    }
+
+private:
+    const int priority;
+    int& last_priority;
+    bool& in_order;
+};
+
+static void bench(int number_deferreds) {
+    std::unique_ptr <Selector> selector(Selector::create("epoll"));
+    Scheduler scheduler(selector.get());
+    scheduler.run(true);
+
+    int last_priority = DEFERRED_PRIORITIES;
+    bool in_order = true;
+
+    vector <std::unique_ptr <Counter>> deferreds;
+    for (int ii=0; ii<number_deferreds; ii++) {
+        int priority = (ii * 7) % 8;
+        deferreds.emplace_back(new Counter(&scheduler, priority, last_priority, in_order));
+    }
+
+    // callLater(0): enqueue all, then one pass to dispatch
+    const int rounds = 10;
+    double start = get_time();
+    for (int round=0; round<rounds; round++) {
+        for (auto& deferred : deferreds) {
+            deferred->callLater(0);
+        }
+
+        last_priority = DEFERRED_PRIORITIES;
+        scheduler.callScheduleLaters();
+    }
+
+    double zero_usecs = (get_time() - start) * 1e6 / (rounds * number_deferreds);
+    ASSERT_MSG (in_order, "callLater(0)s called back out of priority order");
+
+    // reset timeouts, as every read on a connection does
+    start = get_time();
+    for (int round=0; round<rounds; round++) {
+        for (int ii=0; ii<number_deferreds; ii++) {
+            deferreds[ii]->callLater(5000 + (ii % 1000), true);
+        }
+    }
+
+    double reset_usecs = (get_time() - start) * 1e6 / (rounds * number_deferreds);
+
+    // cancel them all
+    start = get_time();
+    for (auto& deferred : deferreds) {
+        deferred->cancel();
+    }
+
+    double cancel_usecs = (get_time() - start) * 1e6 / number_deferreds;
+
+    l_info("deferreds: %d, callLater(0)+dispatch: %.3f usecs, timer reset: %.3f usecs, "
+           "cancel: %.3f usecs", number_deferreds, zero_usecs, reset_usecs, cancel_usecs);
+}
+
+static void benchPost(int number_threads, int posts_per_thread) {
+    std::unique_ptr <Selector> selector(Selector::create("epoll"));
+    Scheduler scheduler(selector.get());
+
+    // only touched on the scheduler's thread
+    long total = 0;
+    const long expected = long(number_threads) * posts_per_thread;
+
+    vector <std::thread> threads;
+    double start = get_time();
+    for (int ii=0; ii<number_threads; ii++) {
+        threads.emplace_back([&scheduler, &total, expected, posts_per_thread]() {
+            for (int jj=0; jj<posts_per_thread; jj++) {
+                scheduler.post([&scheduler, &total, expected]() {
+                    if (++total == expected) {
+                        scheduler.shutdown();
+                    }
+                });
+
+                // give the scheduler a chance to go to sleep now and then
+                if (jj % 1000 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    scheduler.run();
+
+    double usecs = (get_time() - start) * 1e6 / expected;
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    ASSERT_MSG (total == expected, "lost a post()");
+    l_info("post() threads: %d, posts: %ld, post+run: %.3f usecs",
+           number_threads, expected, usecs);
+}
+
+void go(vector <string>& args) {
+    vector <int> sizes;
+    for (size_t ii=1; ii<args.size(); ii++) {
+        sizes.push_back(toInt(args[ii]));
+    }
+
+    if (sizes.empty()) {
+        sizes = {1000, 10000, 100000};
+    }
+
+    for (int number_deferreds : sizes) {
+        bench(number_deferreds);
+    }
+
+    for (int number_threads : {1, 2, 4}) {
+        benchPost(number_threads, 1000000 / number_threads);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#include <k273/runner.h>
+
+int main(int argc, char** argv) {
+    K273::Runner::Config config(argc, argv);
+    config.log_filename = "scheduler_bench.log";
+
+    return K273::Runner::Main(go, config);
+}
@@ -0,0 +1,154 @@
+// kelvin includes
+#include <kelvin/selector.h>
+
+// k273 includes
+#include <k273/util.h>
+#include <k273/logging.h>
+#include <k273/strutils.h>
+#include <k273/exception.h>
+
+// std includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Cost of register / select / cancel on a selector with lots of fds.
+//
+// usage: selector_bench.bin [epoll|poll|uring] [number_fds ...]
+
+using namespace std;
+using namespace K273;
+using namespace Kelvin;
+
+///////////////////////////////////////////////////////////////////////////////
+
+static int raiseFdLimit(int wanted) {
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t) wanted) {
+        rl.rlim_cur = std::min((rlim_t) wanted, rl.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    getrlimit(RLIMIT_NOFILE, &rl);
+    return rl.rlim_cur;
+}
+
+static void bench(const string& selector_type, int number_fds) {
+    const int limit = raiseFdLimit(number_fds + 64);
+    if (limit < number_fds + 64) {
+        l_warning("fd limit is %d, capping number of fds", limit);
+        number_fds = limit - 64;
+    }
+
+    std::unique_ptr <Selector> selector(Selector::create(selector_type));
+
+    vector <int> fds;
+    for (int ii=0; ii<number_fds; ii++) {
+        int fd = eventfd(0, EFD_NONBLOCK);
+        if (fd < 0) {
+            throw SysException("eventfd()", errno);
+        }
+
+        fds.push_back(fd);
+    }
+
+    // register
+    vector <SelectionKey*> keys;
+    double start = get_time();
+    for (int fd : fds) {
+        keys.push_back(selector->registerInterests(fd, OP_READ));
+    }
+
+    double register_usecs = (get_time() - start) * 1e6 / number_fds;
+
+    // lookup / re-register (this was a linear scan)
+    start = get_time();
+    for (int fd : fds) {
+        selector->registerInterests(fd, OP_READ | OP_WRITE);
+    }
+
+    double reregister_usecs = (get_time() - start) * 1e6 / number_fds;
+
+    // make a few ready, spread across the fds
+    const int number_ready = 64;
+    const uint64_t one = 1;
+    for (int ii=0; ii<number_ready; ii++) {
+        int res = write(fds[(ii * (number_fds / number_ready))], &one, sizeof(one));
+        ASSERT (res == sizeof(one));
+    }
+
+    // select (eventfds are writable too, so everything is ready after the re-register above -
+    // put back to read only)
+    for (SelectionKey* key : keys) {
+        key->setOps(OP_READ);
+    }
+
+    const int select_count = 100;
+    int ready_count = 0;
+    start = get_time();
+    for (int ii=0; ii<select_count; ii++) {
+        ready_count = selector->doSelect(0);
+        SelectionKey** ready = selector->getReadyKeys();
+        for (int jj=0; jj<ready_count; jj++) {
+            ready[jj]->reset();
+        }
+    }
+
+    double select_usecs = (get_time() - start) * 1e6 / select_count;
+
+    // cancel all and reap
+    start = get_time();
+    for (SelectionKey* key : keys) {
+        key->cancel();
+    }
+
+    selector->doSelect(0);
+    double cancel_usecs = (get_time() - start) * 1e6 / number_fds;
+
+    l_info("%s fds: %d, register: %.3f usecs, re-register: %.3f usecs, "
+           "select (%d ready): %.1f usecs, cancel: %.3f usecs",
+           selector_type.c_str(), number_fds, register_usecs, reregister_usecs,
+           ready_count, select_usecs, cancel_usecs);
+
+    ASSERT (selector->getKeyCount() == 0);
+
+    for (int fd : fds) {
+        ::close(fd);
+    }
+}
+
+void go(vector <string>& args) {
+    string selector_type = "epoll";
+    if (args.size() > 1) {
+        selector_type = args[1];
+    }
+
+    vector <int> sizes;
+    for (size_t ii=2; ii<args.size(); ii++) {
+        sizes.push_back(toInt(args[ii]));
+    }
+
+    if (sizes.empty()) {
+        sizes = {1000, 10000, 100000};
+    }
+
+    for (int number_fds : sizes) {
+        bench(selector_type, number_fds);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#include <k273/runner.h>
+
+int main(int argc, char** argv) {
+    K273::Runner::Config config(argc, argv);
+    config.log_filename = "selector_bench.log";
+
+    return K273::Runner::Main(go, config);
+}
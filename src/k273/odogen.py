@@ -0,0 +1,522 @@
+''' Odo schema compiler.  Reads a small IDL and writes a c++ header with PACKED reader structs,
+builders, fixed part sizes, MSG_TYPE_ID constants, dispatch glue and json dumpers (see orbit/odo.h
+and orbit/odo_json.h).  Builders are bounds checked against the capacity passed to reset().
+
+usage: python odogen.py schema.odo [output.h]
+
+The IDL looks like:
+
+    # comments start with a hash
+    namespace Feed::Msgs;
+
+    struct Level {
+        double price;
+        int32 size;
+    }
+
+    message Quote = 10 {
+        uint32 instrument_id;
+        string name;
+        int32[] sizes;
+        Level[] levels;
+    }
+
+Primitive types are int8-int64, uint8-uint64, float, double and bool.  'string' is an
+Odo::String, 'T[]' is a PrimitiveSequence for primitive T and a VariableSequence for a struct
+T.  A plain struct field is stored out of line.  Anything variable sized lives after the fixed
+part and is reached via an OffsetPtr, so every field access is O(1).
+'''
+
+import re
+import sys
+
+PRIMITIVES = {
+    "int8": ("int8_t", 1),
+    "int16": ("int16_t", 2),
+    "int32": ("int32_t", 4),
+    "int64": ("int64_t", 8),
+    "uint8": ("uint8_t", 1),
+    "uint16": ("uint16_t", 2),
+    "uint32": ("uint32_t", 4),
+    "uint64": ("uint64_t", 8),
+    "float": ("float", 4),
+    "double": ("double", 8),
+    "bool": ("bool", 1),
+}
+
+OFFSET_PTR_SIZE = 4
+
+
+class SchemaError(Exception):
+    pass
+
+
+class Field(object):
+    # kinds
+    PRIMITIVE, STRING, STRUCT, PRIMITIVE_SEQ, STRUCT_SEQ = range(5)
+
+    def __init__(self, name, type_name, is_seq):
+        self.name = name
+        self.type_name = type_name
+        self.is_seq = is_seq
+        self.kind = None
+
+    def camel(self):
+        return "".join(p[0].upper() + p[1:] for p in self.name.split("_") if p)
+
+    def resolve(self, structs):
+        if self.type_name in PRIMITIVES:
+            self.kind = Field.PRIMITIVE_SEQ if self.is_seq else Field.PRIMITIVE
+
+        elif self.type_name == "string":
+            if self.is_seq:
+                raise SchemaError("string[] not supported (%s)" % self.name)
+            self.kind = Field.STRING
+
+        elif self.type_name in structs:
+            self.kind = Field.STRUCT_SEQ if self.is_seq else Field.STRUCT
+
+        else:
+            raise SchemaError("unknown type '%s' for field %s" % (self.type_name, self.name))
+
+    def is_variable(self):
+        return self.kind != Field.PRIMITIVE
+
+    def ctype(self):
+        return PRIMITIVES[self.type_name][0]
+
+    def fixed_size(self):
+        if self.kind == Field.PRIMITIVE:
+            return PRIMITIVES[self.type_name][1]
+        return OFFSET_PTR_SIZE
+
+    def reader_type(self):
+        if self.kind == Field.PRIMITIVE:
+            return self.ctype()
+        elif self.kind == Field.STRING:
+            return "Odo::OffsetPtr <Odo::String>"
+        elif self.kind == Field.STRUCT:
+            return "Odo::OffsetPtr <%s>" % self.type_name
+        elif self.kind == Field.PRIMITIVE_SEQ:
+            return "Odo::OffsetPtr <Odo::PrimitiveSequence <%s>>" % self.ctype()
+        else:
+            return "Odo::OffsetPtr <Odo::VariableSequence <%s>>" % self.type_name
+
+    def builder_type(self):
+        if self.kind == Field.STRUCT:
+            return "%sBuilder" % self.type_name
+        elif self.kind == Field.PRIMITIVE_SEQ:
+            return "Odo::PrimitiveSequenceBuilder <%s>" % self.ctype()
+        elif self.kind == Field.STRUCT_SEQ:
+            return "Odo::VariableSequenceBuilder <%sBuilder>" % self.type_name
+        return None
+
+
+class Struct(object):
+    def __init__(self, name, msg_type_id=None):
+        self.name = name
+        self.msg_type_id = msg_type_id
+        self.fields = []
+
+    def fixed_size(self):
+        return sum(f.fixed_size() for f in self.fields)
+
+    def variable_fields(self):
+        return [f for f in self.fields if f.is_variable()]
+
+
+###############################################################################
+
+TOKEN_RE = re.compile(r"\s*(?:(#[^\n]*)|([A-Za-z_][A-Za-z0-9_:]*)|(\d+)|(\[\])|(.))")
+
+
+def tokenize(text):
+    for m in TOKEN_RE.finditer(text):
+        comment, ident, number, brackets, other = m.groups()
+        if comment:
+            continue
+        if ident:
+            yield ("ident", ident)
+        elif number:
+            yield ("number", int(number))
+        elif brackets:
+            yield ("[]", brackets)
+        elif other and not other.isspace():
+            yield ("sym", other)
+
+
+class Parser(object):
+    def __init__(self, text):
+        self.tokens = list(tokenize(text))
+        self.pos = 0
+        self.namespace = "K273::Orbit::Msgs"
+        self.structs = []
+
+    def peek(self):
+        if self.pos < len(self.tokens):
+            return self.tokens[self.pos]
+        return (None, None)
+
+    def take(self, kind, value=None):
+        tok = self.peek()
+        if tok[0] != kind or (value is not None and tok[1] != value):
+            raise SchemaError("expected %s got %s" % (value or kind, tok[1]))
+        self.pos += 1
+        return tok[1]
+
+    def parse(self):
+        while self.peek()[0] is not None:
+            keyword = self.take("ident")
+            if keyword == "namespace":
+                self.namespace = self.take("ident")
+                self.take("sym", ";")
+
+            elif keyword in ("struct", "message"):
+                self.parse_struct(keyword == "message")
+
+            else:
+                raise SchemaError("unexpected '%s'" % keyword)
+
+        self.resolve()
+        return self
+
+    def parse_struct(self, is_message):
+        s = Struct(self.take("ident"))
+        if is_message:
+            self.take("sym", "=")
+            s.msg_type_id = self.take("number")
+
+        self.take("sym", "{")
+        while self.peek() != ("sym", "}"):
+            type_name = self.take("ident")
+            is_seq = self.peek()[0] == "[]"
+            if is_seq:
+                self.take("[]")
+            s.fields.append(Field(self.take("ident"), type_name, is_seq))
+            self.take("sym", ";")
+
+        self.take("sym", "}")
+        self.structs.append(s)
+
+    def resolve(self):
+        # structs must be defined before use, keeps the generated header in order
+        seen = {}
+        type_ids = {}
+        for s in self.structs:
+            if s.name in seen:
+                raise SchemaError("duplicate struct %s" % s.name)
+
+            if s.msg_type_id is not None:
+                if s.msg_type_id in type_ids:
+                    raise SchemaError("duplicate message type id %d (%s and %s)" % (
+                        s.msg_type_id, type_ids[s.msg_type_id], s.name))
+                type_ids[s.msg_type_id] = s.name
+
+            for f in s.fields:
+                f.resolve(seen)
+            seen[s.name] = s
+
+
+###############################################################################
+
+class Writer(object):
+    def __init__(self):
+        self.lines = []
+        self.indent = 0
+
+    def __call__(self, line=""):
+        self.lines.append(("    " * self.indent + line) if line else "")
+
+    def text(self):
+        return "\n".join(self.lines) + "\n"
+
+
+def gen_reader(w, s):
+    w("struct %s {" % s.name)
+    w.indent += 1
+    if s.msg_type_id is not None:
+        w("static constexpr uint32_t MSG_TYPE_ID = %d;" % s.msg_type_id)
+    w("static constexpr uint32_t FIXED_SIZE = %d;" % s.fixed_size())
+    w()
+    for f in s.fields:
+        w("%s %s;" % (f.reader_type(), f.name))
+    if not s.fields:
+        # no payload, keep sizeof() zero (as with MessageHeader::data)
+        w("uint8_t data[0];")
+    w.indent -= 1
+    w("} PACKED;")
+    w()
+    w('static_assert(sizeof(%s) == %s::FIXED_SIZE, "%s layout mismatch");' % (s.name, s.name, s.name))
+    w()
+
+
+def gen_builder(w, s):
+    var_fields = s.variable_fields()
+
+    w("class %sBuilder {" % s.name)
+    w("public:")
+    w.indent += 1
+    w("%sBuilder() {" % s.name)
+    w("}")
+    w.indent -= 1
+    w()
+    w("public:")
+    w.indent += 1
+
+    w("void reset(uint8_t* memory, size_t capacity=Odo::UNBOUNDED) {")
+    w.indent += 1
+    w("this->end = Odo::memoryEnd(memory, capacity);")
+    w("Odo::checkCapacity(memory, %s::FIXED_SIZE, this->end);" % s.name)
+    w()
+    w("this->pt = reinterpret_cast <%s*> (memory);" % s.name)
+    w("this->next = memory + %s::FIXED_SIZE;" % s.name)
+    w("this->open_field = -1;")
+    for f in var_fields:
+        w("this->%s_set = false;" % f.name)
+    w.indent -= 1
+    w("}")
+    w()
+
+    for index, f in enumerate(s.fields):
+        if f.kind == Field.PRIMITIVE:
+            w("void set%s(%s value) {" % (f.camel(), f.ctype()))
+            w("    this->pt->%s = value;" % f.name)
+            w("}")
+
+        elif f.kind == Field.STRING:
+            w("void set%s(std::string_view s) {" % f.camel())
+            w.indent += 1
+            w("this->closeOpen();")
+            w("Odo::StringBuilder sb;")
+            w("sb.setMemory(this->next, this->end - this->next);")
+            w("this->pt->%s.set(this->next);" % f.name)
+            w("this->next += sb.set(s);")
+            w("this->%s_set = true;" % f.name)
+            w.indent -= 1
+            w("}")
+
+        else:
+            # struct and sequences hand back a builder, which is closed off when the next
+            # variable field is started or on finalise()
+            if f.kind == Field.STRUCT_SEQ:
+                # indexed gives O(1) index() on the reader, at 4 bytes per element
+                w("%s* start%s(bool indexed=false) {" % (f.builder_type(), f.camel()))
+            else:
+                w("%s* start%s() {" % (f.builder_type(), f.camel()))
+            w.indent += 1
+            w("this->closeOpen();")
+            w("this->pt->%s.set(this->next);" % f.name)
+            if f.kind == Field.STRUCT:
+                w("this->%s_builder.reset(this->next, this->end - this->next);" % f.name)
+            elif f.kind == Field.STRUCT_SEQ:
+                w("this->%s_builder.reset(indexed);" % f.name)
+                w("this->%s_builder.setMemory(this->next, this->end - this->next);" % f.name)
+            else:
+                w("this->%s_builder.reset();" % f.name)
+                w("this->%s_builder.setMemory(this->next, this->end - this->next);" % f.name)
+            w("this->open_field = %d;" % index)
+            w("this->%s_set = true;" % f.name)
+            w("return &this->%s_builder;" % f.name)
+            w.indent -= 1
+            w("}")
+        w()
+
+    w("uint32_t finalise() {")
+    w.indent += 1
+    w("this->closeOpen();")
+    if var_fields:
+        w()
+        w("// unset variable fields still need to point at something valid")
+    for f in var_fields:
+        w("if (!this->%s_set) {" % f.name)
+        w.indent += 1
+        if f.kind == Field.STRING:
+            w('this->set%s("");' % f.camel())
+        else:
+            w("this->start%s();" % f.camel())
+            w("this->closeOpen();")
+        w.indent -= 1
+        w("}")
+    w()
+    w("return this->next - reinterpret_cast <uint8_t*> (this->pt);")
+    w.indent -= 1
+    w("}")
+    w.indent -= 1
+    w()
+
+    w("private:")
+    w.indent += 1
+    w("void closeOpen() {")
+    w.indent += 1
+    builder_fields = [(i, f) for i, f in enumerate(s.fields) if f.builder_type() is not None]
+    if builder_fields:
+        w("switch (this->open_field) {")
+        for index, f in builder_fields:
+            w("case %d:" % index)
+            w("    this->next += this->%s_builder.finalise();" % f.name)
+            w("    break;")
+        w("default:")
+        w("    break;")
+        w("}")
+        w()
+    w("this->open_field = -1;")
+    w.indent -= 1
+    w("}")
+    w.indent -= 1
+    w()
+
+    w("private:")
+    w.indent += 1
+    w("%s* pt;" % s.name)
+    w("uint8_t* next;")
+    w("uint8_t* end;")
+    w("int open_field;")
+    for f in var_fields:
+        w("bool %s_set;" % f.name)
+    for f in s.fields:
+        if f.builder_type() is not None:
+            w("%s %s_builder;" % (f.builder_type(), f.name))
+    w.indent -= 1
+    w("};")
+    w()
+
+    if s.msg_type_id is not None:
+        w("typedef Odo::MessageBuilder <%sBuilder, %s::MSG_TYPE_ID> %sMessageBuilder;" % (
+            s.name, s.name, s.name))
+        w()
+
+
+def gen_json(w, s):
+    w("inline void writeJson(Odo::JsonWriter& w, const %s* msg) {" % s.name)
+    w.indent += 1
+    w("w.beginObject();")
+    for f in s.fields:
+        w('w.key("%s");' % f.name)
+        if f.kind == Field.PRIMITIVE:
+            w("w.value(msg->%s);" % f.name)
+        elif f.kind == Field.STRING:
+            w("w.value(*msg->%s);" % f.name)
+        elif f.kind == Field.STRUCT:
+            w("writeJson(w, &msg->%s.get());" % f.name)
+        else:
+            w("w.beginArray();")
+            if f.kind == Field.PRIMITIVE_SEQ:
+                w("for (%s v : *msg->%s) {" % (f.ctype(), f.name))
+                w("    w.value(v);")
+            else:
+                w("for (const %s* v : *msg->%s) {" % (f.type_name, f.name))
+                w("    writeJson(w, v);")
+            w("}")
+            w("w.endArray();")
+    w("w.endObject();")
+    w.indent -= 1
+    w("}")
+    w()
+
+
+def gen_dump_json(w, messages):
+    w("// writes the message as a single json line, returns false if message type is unknown")
+    w("inline bool dumpJson(const Odo::MessageHeader* header, Odo::JsonWriter& w) {")
+    w.indent += 1
+    w("switch (header->message_type_id) {")
+    for s in messages:
+        w("case %s::MSG_TYPE_ID:" % s.name)
+        w.indent += 1
+        w("w.beginObject();")
+        w('w.key("type");')
+        w('w.value("%s");' % s.name)
+        w('w.key("msg");')
+        w("writeJson(w, header->getPayload <%s> ());" % s.name)
+        w("w.endObject();")
+        w("break;")
+        w.indent -= 1
+        w()
+    w("default:")
+    w("    return false;")
+    w("}")
+    w()
+    w("w.newline();")
+    w("return true;")
+    w.indent -= 1
+    w("}")
+
+
+def gen_dispatch(w, messages):
+    w("// calls handler.on<Message>(const Message*), returns false if message type is unknown")
+    w("template <typename Handler>")
+    w("bool dispatch(const Odo::MessageHeader* header, Handler& handler) {")
+    w.indent += 1
+    w("switch (header->message_type_id) {")
+    for s in messages:
+        w("case %s::MSG_TYPE_ID:" % s.name)
+        w("    handler.on%s(header->getPayload <%s> ());" % (s.name, s.name))
+        w("    return true;")
+        w()
+    w("default:")
+    w("    return false;")
+    w("}")
+    w.indent -= 1
+    w("}")
+
+
+def generate(schema, source_name):
+    w = Writer()
+    w("#pragma once")
+    w()
+    w("// generated by odogen.py from %s - do not edit" % source_name)
+    w()
+    w("// orbit includes")
+    w("#include <orbit/odo.h>")
+    w("#include <orbit/odo_json.h>")
+    w()
+    w("// std includes")
+    w("#include <cstdint>")
+    w("#include <string_view>")
+    w()
+    w("namespace %s {" % schema.namespace)
+    w()
+    w.indent += 1
+    w("namespace Odo = K273::Orbit::Odo;")
+    w()
+
+    for s in schema.structs:
+        w("/" * 79)
+        w("// %s" % s.name)
+        w()
+        gen_reader(w, s)
+        gen_builder(w, s)
+        gen_json(w, s)
+
+    messages = [s for s in schema.structs if s.msg_type_id is not None]
+    if messages:
+        w("/" * 79)
+        w()
+        gen_dispatch(w, messages)
+        w()
+        gen_dump_json(w, messages)
+
+    w.indent -= 1
+    w()
+    w("}")
+    return w.text()
+
+
+def main(args):
+    if len(args) not in (1, 2):
+        sys.stderr.write(__doc__)
+        return 1
+
+    schema = Parser(open(args[0]).read()).parse()
+    text = generate(schema, args[0])
+
+    if len(args) == 2:
+        with open(args[1], "w") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))